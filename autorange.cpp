@@ -0,0 +1,97 @@
+#include "autorange.h"
+
+using namespace std;
+using namespace cv;
+
+RangeEstimator::RangeEstimator() {
+    cell = 16;
+    minGradient = 20.0f;
+    uniqueness = 0.8f;
+    quantile = 0.02;
+    margin = 8;
+}
+
+DisparityRangeEstimate RangeEstimator::estimate(BlockMatching &bm, Mat left, int blocksize) {
+    TRACE_SCOPE("autorange");
+
+    DisparityRangeEstimate r;
+    r.valid = false;
+    r.minDisparity = -BlockMatching::FULL_RANGE;
+    r.maxDisparity = BlockMatching::FULL_RANGE;
+    r.samples = 0;
+    r.accepted = 0;
+
+    int64 t = getTickCount();
+
+    int width = left.cols;
+    int blockMargin = blocksize / 2;
+    int start = blockMargin;
+    int stopW = width - blockMargin;
+    int stopH = left.rows - blockMargin;
+
+    // gradient magnitude of the gray image
+    Mat gray, gx, gy, magnitude;
+    if(left.channels() == 3) cvtColor(left, gray, COLOR_BGR2GRAY);
+    else gray = left;
+    Sobel(gray, gx, CV_32F, 1, 0);
+    Sobel(gray, gy, CV_32F, 0, 1);
+    cv::magnitude(gx, gy, magnitude);
+
+    bm.prepare(blocksize);
+
+    vector<int> histogram(2 * width + 1, 0);       // index disparity + width
+    vector<float> costs(stopW - start);
+    vector<float> buf(costs.size());
+
+    for(int cy = start; cy < stopH; cy += cell) {
+        for(int cx = start; cx < stopW; cx += cell) {
+            // strongest gradient of the cell
+            Rect c = Rect(cx, cy, cell, cell) & Rect(start, start, stopW - start, stopH - start);
+            Point p;
+            double best;
+            minMaxLoc(magnitude(c), 0, &best, 0, &p);
+            if(best < minGradient) continue;
+
+            int x = c.x + p.x;
+            int y = c.y + p.y;
+            r.samples++;
+
+            // full scanline, combined costs of all functions
+            fill(costs.begin(), costs.end(), 0.0f);
+            for(size_t i = 0; i < bm.functions.size(); ++i) {
+                bm.functions[i]->aggregateRow(x, start, stopW, y, &buf[0]);
+                for(size_t k = 0; k < costs.size(); ++k) costs[k] += buf[k];
+            }
+
+            int winner = (int) (min_element(costs.begin(), costs.end()) - costs.begin());
+            float second = numeric_limits<float>::max();
+            for(int k = 0; k < (int) costs.size(); ++k) {
+                if(abs(k - winner) > 1) second = min(second, costs[k]);
+            }
+            if(!(costs[winner] < uniqueness * second)) continue;
+
+            histogram[x - (start + winner) + width]++;
+            r.accepted++;
+        }
+    }
+
+    r.seconds = (getTickCount() - t) / getTickFrequency();
+    if(r.accepted < 20) return r;
+
+    // quantiles of the accepted disparities (histogram bins of the low-th and high-th sample)
+    int low = (int) (quantile * r.accepted);
+    int high = min((int) ((1.0 - quantile) * r.accepted), r.accepted - 1);
+    int count = 0, lo = -1, hi = -1;
+    for(int i = 0; i < (int) histogram.size() && hi < 0; ++i) {
+        count += histogram[i];
+        if(lo < 0 && count > low) lo = i;
+        if(count > high) hi = i;
+    }
+
+    int m = max(margin, (hi - lo) / 10);
+    r.minDisparity = max(lo - width - m, -(width - 1));
+    r.maxDisparity = min(hi - width + m, width - 1);
+    r.valid = true;
+
+    return r;
+}
@@ -0,0 +1,38 @@
+#ifndef AUTORANGE_H
+#define AUTORANGE_H
+
+#include <opencv2/opencv.hpp>
+#include "blockmatching.h"
+
+struct DisparityRangeEstimate {
+    bool valid;             // enough reliable samples
+    int minDisparity;       // x1 - x2, margin included
+    int maxDisparity;
+    int samples;            // matched pixels
+    int accepted;           // pixels with a unique match
+    double seconds;
+};
+
+/* Disparity range pre-pass.
+ * The pixel with the strongest gradient of every cell x cell block (if textured at all) is matched
+ * with the cost functions of bm against the full scanline (winner takes all). Matches whose best
+ * cost is not clearly below the second best outside +-1 are dropped. The range is given by the
+ * low/high quantiles of the remaining disparities plus a margin. At most one scanline of entries
+ * per cell, with cell = 16 about 1/256 of the entries of a full range run.
+ */
+class RangeEstimator
+{
+public:
+    int cell;               // one sample per cell x cell pixels
+    float minGradient;      // gray level gradient magnitude (sobel) of textured pixels
+    float uniqueness;       // best < uniqueness * second best
+    double quantile;        // dropped at both ends
+    int margin;             // added at both ends, at least, 10% of the range otherwise
+
+    RangeEstimator();
+
+    // bm.functions have to be set up for left
+    DisparityRangeEstimate estimate(BlockMatching &bm, cv::Mat left, int blocksize);
+};
+
+#endif // AUTORANGE_H
@@ -0,0 +1,502 @@
+/*
+ * Microbenchmarks of the matcher components on deterministic synthetic input.
+ *
+ * Usage: mybm_bench [--filter <substring>] [--min-time <seconds>] [--json <file>] [--csv <file>]
+ *
+ * Every benchmark reports nanoseconds per entry (one DSI entry for cost functions and the dynamic
+ * programming, one pixel for filters) and the throughput in entries per second. The fastest of
+ * several repetitions is reported, each repetition runs until min-time is reached.
+ */
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+#include "blockmatching.h"
+#include "dpmat.h"
+#include "filters.h"
+#include "postfilter.h"
+
+using namespace std;
+using namespace cv;
+
+static const uint64 SEED = 0x6d79626d;     // same input in every run
+static const int REPETITIONS = 5;
+
+struct BenchResult {
+    string name;
+    double entries;         // per iteration
+    long iterations;
+    double seconds;         // per iteration (fastest repetition)
+};
+
+// volatile sink, results must not be optimized away
+static volatile float sink = 0;
+
+class Benchmark {
+public:
+    string name;
+    double entries;
+
+    Benchmark(string name, double entries) : name(name), entries(entries) {}
+    virtual ~Benchmark() {}
+
+    virtual void setup() {}         // large inputs are only allocated while the benchmark runs
+    virtual void run() = 0;
+    virtual void teardown() {}
+};
+
+struct Options {
+    string filter;
+    double minTime;
+    string jsonFile;
+    string csvFile;
+};
+
+// random texture with some structure, right image is the left one shifted by 8 pixels plus noise
+static void syntheticPair(Size size, Mat &left, Mat &right) {
+    RNG rng(SEED);
+
+    Mat small(size.height / 4 + 1, size.width / 4 + 1, CV_8UC3);
+    rng.fill(small, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    resize(small, left, Size(size.width + 8, size.height), 0, 0, INTER_LINEAR);
+
+    Mat noise(left.size(), CV_8UC3);
+    rng.fill(noise, RNG::UNIFORM, Scalar::all(0), Scalar::all(8));
+    left += noise;
+
+    right = left.colRange(0, size.width).clone();
+    left = left.colRange(8, size.width + 8).clone();
+}
+
+static BenchResult measure(Benchmark &b, double minTime) {
+    BenchResult r;
+    r.name = b.name;
+    r.entries = b.entries;
+    r.iterations = 0;
+    r.seconds = numeric_limits<double>::max();
+
+    b.run();        // warm up caches, lazy allocations
+
+    for(int rep = 0; rep < REPETITIONS; ++rep) {
+        long iterations = 0;
+        int64 start = getTickCount();
+        double elapsed = 0;
+
+        do {
+            b.run();
+            iterations++;
+            elapsed = (getTickCount() - start) / getTickFrequency();
+        } while(elapsed < minTime);
+
+        if(elapsed / iterations < r.seconds) {
+            r.seconds = elapsed / iterations;
+            r.iterations = iterations;
+        }
+    }
+
+    return r;
+}
+
+/*
+ * Cost functions: aggregate over a band of 16 disparities for every column of one scanline
+ */
+class CostBench : public Benchmark {
+public:
+    CostFunction* f;
+    int y, x0, x1;
+
+    static const int DISPARITIES = 16;
+
+    CostBench(string name, CostFunction* f, int blocksize, int border) : Benchmark(name, 0), f(f) {
+        f->setBlocksize(blocksize);
+
+        y = f->left.rows / 2;
+        x0 = border + DISPARITIES;
+        x1 = f->left.cols - border;
+        entries = (double) (x1 - x0) * DISPARITIES;
+    }
+
+    ~CostBench() {
+        delete f;
+    }
+
+    void run() {
+        float sum = 0;
+        float costs[DISPARITIES];
+        for(int x = x0; x < x1; ++x) {
+            f->aggregateRow(x, x - DISPARITIES + 1, x + 1, y, costs);
+            for(int d = 0; d < DISPARITIES; ++d)
+                sum += costs[d];
+        }
+        sink = sum;
+    }
+};
+
+/*
+ * RGB distance lookup of 16 disparities per pixel: DistanceLUT against the exact table with one
+ * entry per sum of squared differences (3*255*255 + 1 floats) it replaces
+ */
+class DistanceLUTBench : public Benchmark {
+public:
+    Mat left, right;            // 8 bit 3 channel
+    bool exact;
+    DistanceLUT lut;
+    vector<float> full;
+
+    static const int DISPARITIES = 16;
+
+    DistanceLUTBench(string name, const Mat &l, const Mat &r, bool exact)
+        : Benchmark(name, (double) l.rows * (l.cols - DISPARITIES) * DISPARITIES), left(l), right(r), exact(exact) {
+        float norm = sqrt(3 * 255.0f * 255.0f);
+        lut.build(norm, 1, false);
+        if(exact) {
+            full.resize(3*255*255 + 1);
+            for(size_t i = 0; i < full.size(); ++i)
+                full[i] = (float) (sqrt((double) i) / norm);
+        }
+    }
+
+    void run() {
+        float sum = 0;
+        const int* sq = lut.sq;
+        for(int y = 0; y < left.rows; ++y) {
+            const uchar* l = left.ptr<uchar>(y);
+            const uchar* r = right.ptr<uchar>(y);
+            for(int x = DISPARITIES; x < left.cols; ++x) {
+                const uchar* a = l + 3 * x;
+                for(int d = 0; d < DISPARITIES; ++d) {
+                    const uchar* b = r + 3 * (x - d);
+                    if(exact) sum += full[sq[a[0] - b[0]] + sq[a[1] - b[1]] + sq[a[2] - b[2]]];
+                    else sum += lut.cost(a[0], a[1], a[2], b[0], b[1], b[2]);
+                }
+            }
+        }
+        sink = sum;
+    }
+};
+
+/*
+ * DPmat on a random width x width disparity space image
+ */
+class PreCalcBench : public Benchmark {
+public:
+    int width;
+    Mat matrix, sum, dirs;
+
+    PreCalcBench(int width) : Benchmark(format("dp/preCalc/w%d", width), (double) width * width), width(width) {}
+
+    void setup() {
+        matrix.create(width, width, CV_32F);
+        RNG rng(SEED);
+        rng.fill(matrix, RNG::UNIFORM, Scalar(0), Scalar(1));
+    }
+
+    void run() {
+        DPmat::preCalc(matrix, sum, dirs);
+        sink = sum.at<float>(0, 0);
+    }
+
+    void teardown() {
+        matrix.release();
+        sum.release();
+        dirs.release();
+    }
+};
+
+// banded disparity space image, disparity range [0, band)
+class PreCalcBandBench : public Benchmark {
+public:
+    int width;
+    DSIBand band;
+    Mat matrix, sum, dirs;
+
+    PreCalcBandBench(int width, int b) : Benchmark(format("dp/preCalcBand%d/w%d", b, width), (double) width * b),
+        width(width), band(-(b - 1), b, width) {}
+
+    void setup() {
+        matrix.create(width, band.width, CV_32F);
+        RNG rng(SEED);
+        rng.fill(matrix, RNG::UNIFORM, Scalar(0), Scalar(1));
+    }
+
+    void run() {
+        DPmat::preCalc(matrix, band, sum, dirs, 1.0f, 1.0f);
+        sink = sum.at<float>(0, band.width - 1);
+    }
+
+    void teardown() {
+        matrix.release();
+        sum.release();
+        dirs.release();
+    }
+};
+
+class BacktrackBench : public Benchmark {
+public:
+    int width;
+    Mat sum, dirs, disparity;
+
+    // entries = pixels of the scanline, the path visits at most 2 * width of them
+    BacktrackBench(int width) : Benchmark(format("dp/backtrack/w%d", width), width), width(width) {}
+
+    void setup() {
+        Mat matrix(width, width, CV_32F);
+        RNG rng(SEED);
+        rng.fill(matrix, RNG::UNIFORM, Scalar(0), Scalar(1));
+
+        DPmat::preCalc(matrix, sum, dirs);
+        disparity = Mat::zeros(1, width, CV_16U);
+    }
+
+    void run() {
+        DPmat::disparityFromDirs(sum, dirs, disparity, 0, 0);
+        sink = disparity.at<ushort>(0, 0);
+    }
+
+    void teardown() {
+        sum.release();
+        dirs.release();
+    }
+};
+
+/*
+ * Filters, entries = pixels
+ */
+class GradientBench : public Benchmark {
+public:
+    Mat image;
+
+    GradientBench(Mat image) : Benchmark(format("filter/getRGBGradientAngle/%dx%d", image.cols, image.rows), image.total()), image(image) {}
+
+    void run() {
+        Mat grad = getRGBGradientAngle(image);
+        sink = grad.at<Vec3f>(0, 0)[0];
+    }
+};
+
+class CondHistBench : public Benchmark {
+public:
+    Mat image;
+
+    CondHistBench(Mat image) : Benchmark(format("filter/condHist/%dx%d", image.cols, image.rows), image.total()), image(image) {}
+
+    void run() {
+        Mat hist = condHist(image, 3);
+        sink = hist.at<int>(0, 0);
+    }
+};
+
+class EntropyBench : public Benchmark {
+public:
+    Mat image;
+
+    EntropyBench(Mat image) : Benchmark(format("filter/RGBEntropy/%dx%d", image.cols, image.rows), image.total()), image(image) {}
+
+    void run() {
+        Mat entropy = RGBEntropy(image, 3);
+        sink = entropy.at<float>(0, 0);
+    }
+};
+
+static void addCostBenchmarks(vector<Benchmark*> &benchmarks) {
+    Mat left, right, leftg, rightg, leftf, rightf;
+    syntheticPair(Size(256, 64), left, right);
+    cvtColor(left, leftg, COLOR_BGR2GRAY);
+    cvtColor(right, rightg, COLOR_BGR2GRAY);
+    leftg.convertTo(leftf, CV_32F);
+    rightg.convertTo(rightf, CV_32F);
+
+    const int censusWindow = 3;
+
+    for(int b = 1; b <= 15; b += 2) {
+        int m = b / 2;
+        int c = censusWindow / 2;
+
+        benchmarks.push_back(new CostBench(format("cost/RGBCost/b%d", b), new RGBCost(left, right, 1), b, m));
+        benchmarks.push_back(new CostBench(format("cost/FloatCost/b%d", b), new FloatCost(leftf, rightf, 1), b, m));
+        benchmarks.push_back(new CostBench(format("cost/CondHistCost/b%d", b), new CondHistCost(left, right, 1), b, m));
+        benchmarks.push_back(new CostBench(format("cost/GrayCost/b%d", b), new GrayCost(leftg, rightg, 1), b, m));
+        benchmarks.push_back(new CostBench(format("cost/GradientCost/b%d", b), new GradientCost(left, right, 1), b, m));
+        benchmarks.push_back(new CostBench(format("cost/CensusCost/b%d", b), new CensusCost(leftg, rightg, censusWindow, 1), b, c));
+        benchmarks.push_back(new CostBench(format("cost/CensusFloatCost/b%d", b), new CensusFloatCost(leftf, rightf, censusWindow, 1), b, m + c));
+        benchmarks.push_back(new CostBench(format("cost/RGBCensusCost/b%d", b), new RGBCensusCost(left, right, censusWindow, 1), b, m + c));
+        benchmarks.push_back(new CostBench(format("cost/RGBGradCensusCost/b%d", b), new RGBGradCensusCost(left, right, censusWindow, 1), b, c));
+
+        // p() per pixel pair
+        CostFunction* robustRGB = new RGBCost(left, right, 1);
+        robustRGB->setRobust(true);
+        benchmarks.push_back(new CostBench(format("cost/RGBCost-robust/b%d", b), robustRGB, b, m));
+
+        // windows between 3x3 and bxb by texture
+        CostFunction* adaptiveRGB = new RGBCost(left, right, 1);
+        adaptiveRGB->setSupport(adaptiveMargins(left, min(b, 3) / 2, m));
+        benchmarks.push_back(new CostBench(format("cost/RGBCost-adaptive/b%d", b), adaptiveRGB, b, m));
+
+        CostFunction* robustGradient = new GradientCost(left, right, 1);
+        robustGradient->setRobust(true);
+        benchmarks.push_back(new CostBench(format("cost/GradientCost-robust/b%d", b), robustGradient, b, m));
+    }
+
+    // lookup table only, large input so the exact table does not stay in cache
+    Mat bigLeft, bigRight;
+    syntheticPair(Size(1024, 256), bigLeft, bigRight);
+    benchmarks.push_back(new DistanceLUTBench("cost/distanceLUT/exact", bigLeft, bigRight, true));
+    benchmarks.push_back(new DistanceLUTBench("cost/distanceLUT/binned", bigLeft, bigRight, false));
+}
+
+static void addDPBenchmarks(vector<Benchmark*> &benchmarks) {
+    for(int w = 256; w <= 8192; w *= 2)
+        benchmarks.push_back(new PreCalcBench(w));
+    for(int w = 256; w <= 8192; w *= 2)
+        benchmarks.push_back(new PreCalcBandBench(w, 128));
+    for(int w = 256; w <= 8192; w *= 2)
+        benchmarks.push_back(new BacktrackBench(w));
+}
+/*
+ * Disparity post processing, entries = pixels
+ */
+class PostFilterBench : public Benchmark {
+public:
+    enum Filter { MEDIAN, SPECKLES, FILL };
+
+    Mat disparity;
+    Filter filter;
+    int radius;
+
+    PostFilterBench(string name, Mat disparity, Filter filter, int radius = 0)
+        : Benchmark(name, disparity.total()), disparity(disparity), filter(filter), radius(radius) {}
+
+    void run() {
+        Mat d = disparity.clone();
+        if(filter == MEDIAN) medianDisparity(d, d, radius);
+        else if(filter == SPECKLES) removeSpeckles(d, 64, 1);
+        else fillOcclusions(d);
+        sink = d.at<ushort>(0, 0);
+    }
+};
+
+// piecewise constant disparities with noise and invalid pixels
+static Mat syntheticDisparity(Size size) {
+    RNG rng(SEED);
+
+    Mat small(size.height / 32 + 1, size.width / 32 + 1, CV_16U);
+    rng.fill(small, RNG::UNIFORM, Scalar::all(1), Scalar::all(128));
+
+    Mat d;
+    resize(small, d, size, 0, 0, INTER_NEAREST);
+
+    Mat noise(size, CV_16U);
+    rng.fill(noise, RNG::UNIFORM, Scalar::all(0), Scalar::all(4));
+    d += noise;
+
+    Mat holes(size, CV_8U);
+    rng.fill(holes, RNG::UNIFORM, Scalar::all(0), Scalar::all(20));
+    d.setTo(Scalar(0), holes == 0);
+
+    return d;
+}
+
+static void addPostFilterBenchmarks(vector<Benchmark*> &benchmarks) {
+    Mat d = syntheticDisparity(Size(1024, 768));
+
+    for(int r = 2; r <= 32; r *= 4)
+        benchmarks.push_back(new PostFilterBench(format("postfilter/median/r%d", r), d, PostFilterBench::MEDIAN, r));
+    benchmarks.push_back(new PostFilterBench("postfilter/speckles", d, PostFilterBench::SPECKLES));
+    benchmarks.push_back(new PostFilterBench("postfilter/fill", d, PostFilterBench::FILL));
+}
+
+static void addFilterBenchmarks(vector<Benchmark*> &benchmarks) {
+    Mat left, right;
+    syntheticPair(Size(512, 512), left, right);
+    benchmarks.push_back(new GradientBench(left));
+
+    // condHist (64 MB histogram) and RGBEntropy are slow, smaller input
+    syntheticPair(Size(128, 128), left, right);
+    benchmarks.push_back(new CondHistBench(left));
+    benchmarks.push_back(new EntropyBench(left));
+}
+
+static void writeJSON(const vector<BenchResult> &results, const string &path) {
+    ofstream out(path.c_str());
+    out << setprecision(10);
+    out << "{\n  \"opencv\": \"" << CV_VERSION << "\",\n  \"threads\": " << getNumThreads() << ",\n  \"benchmarks\": [\n";
+
+    for(size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"entries\": " << r.entries
+            << ", \"iterations\": " << r.iterations
+            << ", \"ns_per_entry\": " << r.seconds * 1e9 / r.entries
+            << ", \"entries_per_second\": " << r.entries / r.seconds << " }"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n}\n";
+}
+
+static void writeCSV(const vector<BenchResult> &results, const string &path) {
+    ofstream out(path.c_str());
+    out << setprecision(10);
+    out << "name,entries,iterations,ns_per_entry,entries_per_second\n";
+
+    for(size_t i = 0; i < results.size(); ++i) {
+        const BenchResult &r = results[i];
+        out << r.name << "," << r.entries << "," << r.iterations << ","
+            << r.seconds * 1e9 / r.entries << "," << r.entries / r.seconds << "\n";
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt;
+    opt.minTime = 0.1;
+
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        if(arg == "--filter" && i + 1 < argc) opt.filter = argv[++i];
+        if(arg == "--min-time" && i + 1 < argc) opt.minTime = atof(argv[++i]);
+        if(arg == "--json" && i + 1 < argc) opt.jsonFile = argv[++i];
+        if(arg == "--csv" && i + 1 < argc) opt.csvFile = argv[++i];
+        if(arg == "-h" || arg == "--help") {
+            cout << "Usage: mybm_bench [--filter <substring>] [--min-time <seconds>] [--json <file>] [--csv <file>]" << endl;
+            return 0;
+        }
+    }
+
+    vector<Benchmark*> benchmarks;
+    addCostBenchmarks(benchmarks);
+    addDPBenchmarks(benchmarks);
+    addFilterBenchmarks(benchmarks);
+    addPostFilterBenchmarks(benchmarks);
+
+    vector<BenchResult> results;
+
+    cout << left << setw(40) << "benchmark" << right << setw(14) << "ns/entry" << setw(18) << "entries/s" << setw(12) << "iterations" << endl;
+
+    for(size_t i = 0; i < benchmarks.size(); ++i) {
+        Benchmark* b = benchmarks[i];
+
+        if(opt.filter.empty() || b->name.find(opt.filter) != string::npos) {
+            b->setup();
+            BenchResult r = measure(*b, opt.minTime);
+            b->teardown();
+            results.push_back(r);
+
+            cout << left << setw(40) << r.name << right << fixed
+                 << setw(14) << setprecision(3) << r.seconds * 1e9 / r.entries
+                 << setw(18) << setprecision(0) << r.entries / r.seconds
+                 << setw(12) << r.iterations << endl;
+        }
+
+        delete b;
+    }
+
+    if(!opt.jsonFile.empty()) writeJSON(results, opt.jsonFile);
+    if(!opt.csvFile.empty()) writeCSV(results, opt.csvFile);
+
+    return 0;
+}
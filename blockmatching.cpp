@@ -1,57 +1,187 @@
 #include "blockmatching.h"
 #include "dpmat.h"
+#include "dsifile.h"
+#include "pointcloud.h"
+
+#include <map>
 
 using namespace std;
 using namespace cv;
 
 BlockMatching::BlockMatching()
 {
+    occlusionSouth = 1.0f;
+    occlusionEast = 1.0f;
+    markOcclusions = false;
+    stripPad = 0;
+    dsiOut = 0;
+    cloudOut = 0;
+
+    setDisparityRange(-FULL_RANGE, FULL_RANGE);
+}
+
+// search only x1 - x2 in [minDisparity, maxDisparity] (left minus right column)
+void BlockMatching::setDisparityRange(int minDisparity, int maxDisparity) {
+    assert(minDisparity <= maxDisparity);
+
+    this->minDisparity = minDisparity;
+    this->maxDisparity = maxDisparity;
 }
 
 BlockMatching::~BlockMatching() {
+    // the strips still use the functions
+    try {
+        finishPreprocessing();
+    }
+    catch(...) {}
+
     for(size_t i = 0; i < functions.size(); ++i)
         delete functions[i];
 }
 
-cv::Mat BlockMatching::disparitySpace(Size imageSize, int blocksize, int y) {
+cv::Mat BlockMatching::disparitySpace(Size imageSize, int blocksize, int y, DSIBand &band) {
     int margin = blocksize / 2;
     int start = margin;
     int stopW = imageSize.width - margin;
-    int workSpace = stopW - start;
 
     // leave out the borders
-    //Mat map = Mat(workSpace, workSpace, CV_32F);        // not preinitialized.. // numeric_limits<float>::max());
-    Mat map = Mat(workSpace, workSpace, CV_32F, numeric_limits<float>::max());
+    return disparitySpace(y, Range(start, stopW), Range(start, stopW), band);
+}
+
+// layout of the section x1 in r1, x2 in r2: square if the disparity range covers all of it
+DSIBand BlockMatching::sectionBand(Range r1, Range r2) const {
+    int lo = r1.start - (r2.end - 1);       // x1 - x2 inside the section
+    int hi = (r1.end - 1) - r2.start;
+    if(minDisparity <= lo && maxDisparity >= hi) return DSIBand();
+
+    int minD = max(minDisparity, lo);
+    int maxD = min(maxDisparity, hi);
+    int first = r1.start - r2.start - maxD;
+
+    // range outside of the section: one column without entries
+    if(minD > maxD) return DSIBand(r2.size(), 1, r2.size());
+
+    return DSIBand(first, maxD - minD + 1, r2.size());
+}
+
+// disparity space image of scanline y: x1 (rows) in r1, x2 in r2 (image columns), layout in band
+cv::Mat BlockMatching::disparitySpace(int y, Range r1, Range r2, DSIBand &band) {
+    TRACE_SCOPE("disparitySpace");
 
-    //int dmax = 101;
-    for(int x1 = start; x1 < stopW; x1++) {
-        float* ptr = map.ptr<float>(x1 - margin);       // [x1 - margin, x2 - margin]
+    band = sectionBand(r1, r2);
+    Mat map = Mat(r1.size(), band.banded() ? band.width : r2.size(), CV_32F, Scalar(0));
 
-        //ptr[max(x1 - 1, start) - margin] = numeric_limits<float>::max();              // fast borders
-        //ptr[min(x1 + dmax, stopW - 1) - margin] = numeric_limits<float>::max();
-        //for(int x2 = x1; x2 < min(x1 + dmax, stopW); x2++) {
-        for(int x2 = start; x2 < stopW; x2++) {
+    vector<float> buf(r2.size());
+
+    // one row kernel call per cost function and disparity space row
+    for(int x1 = r1.start; x1 < r1.end; x1++) {
+        float* ptr = map.ptr<float>(x1 - r1.start);
+
+        // x2 of the disparity range x1 - x2 in [minDisparity, maxDisparity]
+        int a = max(r2.start, x1 - maxDisparity);
+        int b = min(r2.end, x1 - minDisparity + 1);
+        if(a >= b) continue;
+
+        int width = b - a;
+
+        // square [x1 - r1.start, x2 - r2.start], banded [x1 - r1.start, k]
+        if(band.banded()) ptr += (a - r2.start) - (x1 - r1.start) - band.first;
+        else ptr += a - r2.start;
+
+        for(size_t i = 0; i < functions.size(); ++i) {
+            float* out = (i == 0) ? ptr : &buf[0];
+            functions[i]->aggregateRow(x1, a, b, y, out);
+
+            COST_STATS((int) i, y, out, width);
 
             // combine costs
-            float cost = 0;
-            for(size_t i = 0; i < functions.size(); ++i) {
-                float val = functions[i]->aggregate(x1, x2, y);
-                mins[i] = min(mins[i], val);                        // debug
-                maxs[i] = max(maxs[i], val);                        // debug
-                cost += val;
+            if(i > 0) {
+                for(int k = 0; k < width; ++k)
+                    ptr[k] += out[k];
             }
-
-            // x1, x2. Das heißt x1 sind die Zeilen. Wir gehen jedes Mal die Zeilen runter.
-            // geht nur von 0 - workspace, deshalb margin abziehen
-            //map.at<float>(x1 - margin, x2 - margin) = greySad(leftRoi, rightRoi);
-            ptr[x2 - margin] = cost;
         }
     }
     return map;
 }
 
+// one disparity space image per cost function (uncombined), e.g. to try different weightings
+void BlockMatching::disparitySpaces(Size imageSize, int blocksize, int y, vector<Mat> &maps, DSIBand &band) {
+    TRACE_SCOPE("disparitySpaces");
+
+    int margin = blocksize / 2;
+    int start = margin;
+    int stopW = imageSize.width - margin;
+    int workSpace = stopW - start;
+
+    band = sectionBand(Range(start, stopW), Range(start, stopW));
+
+    maps.resize(functions.size());
+    for(size_t i = 0; i < functions.size(); ++i) {
+        maps[i].create(workSpace, band.banded() ? band.width : workSpace, CV_32F);
+        maps[i].setTo(Scalar(0));
+    }
+
+    for(size_t i = 0; i < functions.size(); ++i) {
+        CostFunction* f = functions[i];
+
+        for(int x1 = start; x1 < stopW; x1++) {
+            int a = max(start, x1 - maxDisparity);
+            int b = min(stopW, x1 - minDisparity + 1);
+            if(a >= b) continue;
+
+            float* out = maps[i].ptr<float>(x1 - margin) + (band.banded() ? (a - x1) - band.first : a - margin);
+            f->aggregateRow(x1, a, b, y, out);
+            COST_STATS((int) i, y, out, b - a);
+        }
+    }
+}
+
+// wait for the deferred preprocessing strips, rethrows their exceptions
+void BlockMatching::finishPreprocessing() {
+    preprocessing.wait();
+}
+
+// everything but compute() may read any row: deferred preprocessing has to be done
+void BlockMatching::prepare(int blocksize) {
+    finishPreprocessing();
+
+    for(size_t i = 0; i < functions.size(); ++i)
+        functions[i]->setBlocksize(blocksize);
+}
+
+// dynamic programming disparity space traversion for one scanline, writes back disparity values
+void BlockMatching::computeLine(Size imageSize, int blocksize, int y, Mat &disparity) {
+    int margin = blocksize / 2;
+
+    // deferred preprocessing: rows up to the bottom of the window, a failed strip throws here
+    for(size_t i = 0; i < functions.size(); ++i) {
+        if(!functions[i]->rowsReady.wait(y + margin + 1)) finishPreprocessing();
+    }
+
+    DSIBand band;
+    Mat simmap = disparitySpace(imageSize, blocksize, y, band);
+    if(dsiOut) dsiOut->write(y, simmap);
+
+    Mat sum, dirs;
+
+    // backtracking only touches the entries on the path, so clear stale values first
+    disparity.row(y).setTo(Scalar(0));
+
+    DPmat::preCalc(simmap, band, sum, dirs, occlusionSouth, occlusionEast);
+    DPmat::disparityFromDirs(sum, dirs, band, disparity, y, margin, margin, markOcclusions);
+}
+
+// recompute a subset of scanlines into an existing disparity map (prepare() has to be called before)
+void BlockMatching::computeLines(Size imageSize, int blocksize, const vector<int> &lines, Mat &disparity) {
+    assert(disparity.size() == imageSize && disparity.type() == CV_16U);
+
+    for(size_t i = 0; i < lines.size(); ++i)
+        computeLine(imageSize, blocksize, lines[i], disparity);
+}
 
 Mat BlockMatching::compute(Size imageSize, int blocksize) {
+    TRACE_SCOPE("compute");
+
     Mat disparity = Mat::zeros(imageSize.height, imageSize.width, CV_16U);
 
     int margin = blocksize / 2;
@@ -64,53 +194,168 @@ Mat BlockMatching::compute(Size imageSize, int blocksize) {
 
     cout << "process: " << flush;
 
-    int tenpercent = (stopH - start) / 10;
+    int tenpercent = max((stopH - start) / 10, 1);
 
-    // set blocksize in costfunctions
-    for(size_t i = 0; i < functions.size(); ++i) {
-        functions[i]->blocksize = blocksize;
-        functions[i]->margin = blocksize / 2;
-    }
+    // deferred preprocessing continues while the first scanlines are matched (computeLine waits),
+    // unless the window needs wider borders than it allocated
+    if(margin > stripPad) finishPreprocessing();
+    for(size_t i = 0; i < functions.size(); ++i)
+        functions[i]->setBlocksize(blocksize);
 
-    mins.reserve(functions.size()); for(size_t i = 0; i < functions.size(); ++i) mins[i] = numeric_limits<float>::max();    // debug
-    maxs.reserve(functions.size()); for(size_t i = 0; i < functions.size(); ++i) maxs[i] = numeric_limits<float>::min();    // debug
+    const int cloudBatch = 64;      // scanlines per reprojection
+    int reprojected = 0;
 
     // Each scanline do dynamic programming disparity space traversion, write back disparity values
     for(int y = start; y < stopH; ++y) {
-        Mat simmap = disparitySpace(imageSize, blocksize, y);
-
-        Mat sum, dirs;
+        computeLine(imageSize, blocksize, y, disparity);
 
-        DPmat::preCalc(simmap, sum, dirs);
-        DPmat::disparityFromDirs(sum, dirs, disparity, y, margin);
+        if(cloudOut && y + 1 - reprojected >= cloudBatch) {
+            cloudOut->write(disparity, reprojected, y + 1);
+            reprojected = y + 1;
+        }
 
         if(((stopH - y) % tenpercent) == 0) cout << (((stopH - y)*10) / tenpercent) << "%, " << flush;
     }
     cout << endl;
 
-    for(size_t i = 0; i < functions.size(); ++i)                            // debug
-        cout << i << ": min: " << mins[i] << " max: " << maxs[i] << endl;   // debug
+    finishPreprocessing();
+    if(cloudOut) cloudOut->write(disparity, reprojected, imageSize.height);
+
+    return disparity;
+}
+
+/* Dynamic programming on a section of scanline y around the image columns [x0, x1) only.
+ * The optimal path of the full scanline can not be bounded exactly, but with a disparity limit
+ * the section rows x0 - pad .. x1 + pad and columns +- maxDisparity cover the relevant part,
+ * the padding absorbs the fixed start/end of the path. maxDisparity < 0: full width.
+ * Writes the disparities of [x0, x1) into line (1 x width, CV_16U).
+ */
+void BlockMatching::computeSpan(Size imageSize, int blocksize, int y, int x0, int x1, int maxDisparity, int pad, Mat &line) {
+    int margin = blocksize / 2;
+    int start = margin;
+    int stopW = imageSize.width - margin;
+
+    if(maxDisparity < 0) maxDisparity = imageSize.width;
+
+    Range r1(max(x0 - pad, start), min(x1 + pad, stopW));
+    Range r2(max(r1.start - maxDisparity, start), min(r1.end + maxDisparity, stopW));
+    if(r1.start >= r1.end) return;
+
+    DSIBand band;
+    Mat simmap = disparitySpace(y, r1, r2, band);
+    Mat sum, dirs;
+
+    DPmat::preCalc(simmap, band, sum, dirs, occlusionSouth, occlusionEast);
+    DPmat::disparityFromDirs(sum, dirs, band, line, 0, r1.start, r2.start, markOcclusions);
+}
+
+// disparity inside roi only, only the scanlines of roi are matched
+Mat BlockMatching::computeROI(Size imageSize, int blocksize, Rect roi, int maxDisparity, int pad) {
+    int margin = blocksize / 2;
+    Mat disparity = Mat::zeros(roi.height, roi.width, CV_16U);
+
+    Rect area = roi & Rect(0, 0, imageSize.width, imageSize.height);
+    if(area.empty()) return disparity;
+
+    prepare(blocksize);
+
+    Mat line(1, imageSize.width, CV_16U);
+    for(int y = max(area.y, margin); y < min(area.y + area.height, imageSize.height - margin); ++y) {
+        line.setTo(Scalar(0));
+        computeSpan(imageSize, blocksize, y, area.x, area.x + area.width, maxDisparity, pad, line);
+
+        Mat dst = disparity.row(y - roi.y).colRange(area.x - roi.x, area.x - roi.x + area.width);
+        line.colRange(area.x, area.x + area.width).copyTo(dst);
+    }
 
     return disparity;
 }
 
+// disparity at single pixels, points of one scanline which lie close together share a section
+vector<ushort> BlockMatching::computePoints(Size imageSize, int blocksize, const vector<Point> &points, int maxDisparity, int pad) {
+    int margin = blocksize / 2;
+    vector<ushort> result(points.size(), 0);
+
+    // point indices per scanline, sorted by column
+    map<int, vector<pair<int, size_t> > > lines;
+    for(size_t i = 0; i < points.size(); ++i) {
+        const Point &p = points[i];
+        if(p.y < margin || p.y >= imageSize.height - margin || p.x < 0 || p.x >= imageSize.width) continue;
+
+        lines[p.y].push_back(make_pair(p.x, i));
+    }
+
+    prepare(blocksize);
+
+    Mat line(1, imageSize.width, CV_16U);
+    for(map<int, vector<pair<int, size_t> > >::iterator it = lines.begin(); it != lines.end(); ++it) {
+        int y = it->first;
+        vector<pair<int, size_t> > &cols = it->second;
+        sort(cols.begin(), cols.end());
+
+        size_t first = 0;
+        while(first < cols.size()) {
+            // grow the section while the gap is smaller than two paddings
+            size_t last = first;
+            while(last + 1 < cols.size() && cols[last + 1].first - cols[last].first <= 2 * pad) last++;
+
+            line.setTo(Scalar(0));
+            computeSpan(imageSize, blocksize, y, cols[first].first, cols[last].first + 1, maxDisparity, pad, line);
+
+            for(size_t k = first; k <= last; ++k)
+                result[cols[k].second] = line.at<ushort>(0, cols[k].first);
+
+            first = last + 1;
+        }
+    }
+
+    return result;
+}
+
+// Dynamic programming only, on a saved cost volume (cost functions are not used)
+Mat BlockMatching::computeFromCosts(DSIReader &dsi) {
+    TRACE_SCOPE("computeFromCosts");
+
+    const DSIHeader &h = dsi.header;
+    Mat disparity = Mat::zeros(h.height, h.width, CV_16U);
+
+    int margin = h.blocksize / 2;
+    DSIBand band = dsi.band();
+
+    for(int i = 0; i < h.rows; ++i) {
+        Mat simmap = dsi.row(i);
+        Mat sum, dirs;
+
+        DPmat::preCalc(simmap, band, sum, dirs, occlusionSouth, occlusionEast);
+        DPmat::disparityFromDirs(sum, dirs, band, disparity, h.firstRow + i, margin, margin, markOcclusions);
+    }
+
+    return disparity;
+}
+
+// weighted sum of disparity space images
 Mat BlockMatching::combineDisparitySpace(vector<Mat> &maps, vector<float> &factors) {
     assert(maps.size() > 0);
+    assert(maps.size() == factors.size());
+    assert(maps[0].type() == CV_32F);
 
     int width = maps[0].cols;
     int height = maps[0].rows;
     Mat combined = Mat(height, width, maps[0].type());
 
     for(int y = 0; y < height; ++y) {
-        for(int x = 0; x < width; ++x) {
-
-            float sum = 0;
-            for(size_t i = 0; i < maps.size(); ++i) {
-                // erste map...
-                sum += maps[i].at<float>(y, x) * factors[i];
-            }
-
-            combined.at<float>(y, x) = sum;
+        float* dst = combined.ptr<float>(y);
+
+        const float* src = maps[0].ptr<float>(y);
+        float f = factors[0];
+        for(int x = 0; x < width; ++x)
+            dst[x] = src[x] * f;
+
+        for(size_t i = 1; i < maps.size(); ++i) {
+            src = maps[i].ptr<float>(y);
+            f = factors[i];
+            for(int x = 0; x < width; ++x)
+                dst[x] += src[x] * f;
         }
     }
 
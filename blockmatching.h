@@ -4,6 +4,13 @@
 #include <opencv2/opencv.hpp>
 #include <limits>
 #include "filters.h"
+#include "trace.h"
+#include "costlut.h"
+#include "mutualinfo.h"
+#include "coststats.h"
+#include "paddedimage.h"
+#include "taskgraph.h"
+#include "dpmat.h"
 
 /* interface cost_function:
  *   aggregate(roiLeft, roiRight)
@@ -23,8 +30,19 @@ public:
     float normCost;
     float normWin;
 
+    bool robust;        // apply p() per pixel pair inside aggregation (RGBCost, GradientCost)
+
+    // preprocessed rows. Row local functions constructed with DeferRows only allocate, their
+    // preprocessing runs strip by strip in prepareRows() and the matcher waits for the rows it reads
+    struct DeferRows {
+        int pad;        // PaddedImage border, wide enough for the block size of the matcher
+        explicit DeferRows(int pad) : pad(pad) {}
+    };
+    RowProgress rowsReady;
+
     CostFunction( cv::Mat left, cv::Mat right, float lambda) {
 		lambda = 1.0;
+        robust = false;
         this->left = left;
         this->right = right;
         imageType(left, right);
@@ -37,18 +55,170 @@ public:
         return true;
     }
 
+    virtual void setBlocksize(int blocksize) {
+        this->blocksize = blocksize;
+        this->margin = blocksize / 2;
+    }
+
+    // cost functions with lookup tables rebuild them here
+    virtual void setLambda(float lambda) {
+        this->lambda = lambda;
+    }
+
+    virtual void setRobust(bool robust) {
+        this->robust = robust;
+    }
+
+    // adaptive windows, CV_8U margin per pixel of the left image (see adaptiveMargins)
+    // cost functions without block window ignore it
+    virtual void setSupport(cv::Mat margins) {}
+
+    // deferred preprocessing of rows [y0, y1), strips run concurrently
+    virtual void prepareRows(int y0, int y1) {}
+
     virtual float aggregate(int x1, int x2, int y) = 0;
 
+    // costs of x1 against x2Start .. x2End - 1, one call per disparity space row
+    virtual void aggregateRow(int x1, int x2Start, int x2End, int y, float* out) {
+        for(int x2 = x2Start; x2 < x2End; ++x2)
+            out[x2 - x2Start] = aggregate(x1, x2, y);
+    }
+
     float p(float cost) {
-        return 1 - exp(-cost / lambda);
+        return RobustLUT::eval(cost / lambda);      // 1 - exp(-cost / lambda)
     }
 
-    ~CostFunction() {}
+    virtual ~CostFunction() {}
 };
 
-class RGBCost : public CostFunction {
+#if defined(__GNUC__)
+#define MYBM_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+#define MYBM_INLINE __forceinline
+#else
+#define MYBM_INLINE inline
+#endif
+
+/* Block size specialized aggregation.
+ * Derived implements MYBM_INLINE float window(int x1, int x2, int y, int m) over -m..m and
+ * reserve(int m), which makes its PaddedImage borders wide enough for windows of margin m. The row
+ * kernels instantiate it with a compile time margin for block sizes 1 - 15 (unrolled, window in
+ * registers), other block sizes use the runtime margin. setBlocksize() selects the kernel.
+ * Adaptive windows (setSupport): x1 is fixed per disparity space row, so every row picks the kernel
+ * of its own margin (at most blocksize / 2) and is scaled to the blocksize window area.
+ */
+template<class Derived>
+class BlockKernelCost : public CostFunction {
 public:
-    RGBCost(cv::Mat left, cv::Mat right, float lambda) : CostFunction(left, right, lambda) {}
+    typedef void (BlockKernelCost::*RowKernel)(int x1, int x2Start, int x2End, int y, float* out);
+
+    static const int FIXED_MARGINS = 8;
+
+    RowKernel rowKernel;
+    RowKernel kernels[FIXED_MARGINS];
+    cv::Mat support;        // CV_8U margin per pixel of the left image, empty: margin everywhere
+
+    BlockKernelCost(cv::Mat left, cv::Mat right, float lambda) : CostFunction(left, right, lambda) {
+        kernels[0] = &BlockKernelCost::template rowFixed<0>;
+        kernels[1] = &BlockKernelCost::template rowFixed<1>;
+        kernels[2] = &BlockKernelCost::template rowFixed<2>;
+        kernels[3] = &BlockKernelCost::template rowFixed<3>;
+        kernels[4] = &BlockKernelCost::template rowFixed<4>;
+        kernels[5] = &BlockKernelCost::template rowFixed<5>;
+        kernels[6] = &BlockKernelCost::template rowFixed<6>;
+        kernels[7] = &BlockKernelCost::template rowFixed<7>;
+        rowKernel = &BlockKernelCost::rowGeneric;
+    }
+
+    void setBlocksize(int blocksize) {
+        CostFunction::setBlocksize(blocksize);
+
+        rowKernel = (margin < FIXED_MARGINS) ? kernels[margin] : &BlockKernelCost::rowGeneric;
+        static_cast<Derived*>(this)->reserve(margin);
+    }
+
+    void setSupport(cv::Mat margins) {
+        assert(margins.empty() || (margins.type() == CV_8U && margins.size() == left.size()));
+        support = margins;
+    }
+
+    float aggregate(int x1, int x2, int y) {
+        if(support.empty()) return static_cast<Derived*>(this)->window(x1, x2, y, margin);
+
+        float cost;
+        aggregateRow(x1, x2, x2 + 1, y, &cost);
+        return cost;
+    }
+
+    void aggregateRow(int x1, int x2Start, int x2End, int y, float* out) {
+        if(support.empty()) {
+            (this->*rowKernel)(x1, x2Start, x2End, y, out);
+            return;
+        }
+
+        int m = std::min((int) support.at<uchar>(y, x1), margin);
+        if(m < FIXED_MARGINS) (this->*kernels[m])(x1, x2Start, x2End, y, out);
+        else rowMargin(m, x1, x2Start, x2End, y, out);
+
+        if(m == margin) return;
+
+        // same scale as the blocksize window
+        float scale = (float) ((2*margin + 1) * (2*margin + 1)) / ((2*m + 1) * (2*m + 1));
+        for(int x2 = x2Start; x2 < x2End; ++x2)
+            out[x2 - x2Start] *= scale;
+    }
+
+    template<int M>
+    void rowFixed(int x1, int x2Start, int x2End, int y, float* out) {
+        Derived* self = static_cast<Derived*>(this);
+        for(int x2 = x2Start; x2 < x2End; ++x2)
+            out[x2 - x2Start] = self->window(x1, x2, y, M);
+    }
+
+    void rowMargin(int m, int x1, int x2Start, int x2End, int y, float* out) {
+        Derived* self = static_cast<Derived*>(this);
+        for(int x2 = x2Start; x2 < x2End; ++x2)
+            out[x2 - x2Start] = self->window(x1, x2, y, m);
+    }
+
+    void rowGeneric(int x1, int x2Start, int x2End, int y, float* out) {
+        rowMargin(margin, x1, x2Start, x2End, y, out);
+    }
+};
+
+class RGBCost : public BlockKernelCost<RGBCost> {
+public:
+    DistanceLUT lut;
+    PaddedImage lpad, rpad;     // planar B, G, R
+
+    RGBCost(cv::Mat left, cv::Mat right, float lambda) : BlockKernelCost<RGBCost>(left, right, lambda), lpad(left), rpad(right) {
+        buildLUT();
+    }
+
+    RGBCost(cv::Mat left, cv::Mat right, float lambda, DeferRows defer) : BlockKernelCost<RGBCost>(left, right, lambda) {
+        lpad.allocate(left, defer.pad);
+        rpad.allocate(right, defer.pad);
+        buildLUT();
+    }
+
+    void prepareRows(int y0, int y1) {
+        lpad.fill(y0, y1);
+        rpad.fill(y0, y1);
+    }
+
+    void buildLUT() {
+        lut.build(sqrt(255*255 + 255*255 + 255*255), lambda, robust);     // normalize to winsize*1.0
+    }
+
+    void setLambda(float lambda) {
+        CostFunction::setLambda(lambda);
+        buildLUT();
+    }
+
+    void setRobust(bool robust) {
+        CostFunction::setRobust(robust);
+        buildLUT();
+    }
 
     bool imageType(cv::Mat left, cv::Mat right) {
         assert(left.type() == right.type() && "imgL imgR types not equal");
@@ -57,22 +227,31 @@ public:
         return true;
     }
 
+    void reserve(int m) {
+        lpad.reserve(m);
+        rpad.reserve(m);
+    }
+
     // aggregate over a ROI of input images
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for (int i = y - margin; i <= y + margin; ++i) {
-            cv::Vec3b* lptr = left.ptr<cv::Vec3b>(i);
-            cv::Vec3b* rptr = right.ptr<cv::Vec3b>(i);
-
-            for ( int j = -margin; j <= margin; ++j) {
-                sum += eukl(lptr[x1 + j], rptr[x2 + j]);      // cost function
+        for (int i = y - m; i <= y + m; ++i) {
+            const uchar* lb = lpad.row<uchar>(0, i) + x1;
+            const uchar* lg = lpad.row<uchar>(1, i) + x1;
+            const uchar* lr = lpad.row<uchar>(2, i) + x1;
+            const uchar* rb = rpad.row<uchar>(0, i) + x2;
+            const uchar* rg = rpad.row<uchar>(1, i) + x2;
+            const uchar* rr = rpad.row<uchar>(2, i) + x2;
+
+            for ( int j = -m; j <= m; ++j) {
+                sum += lut.cost(lb[j], lg[j], lr[j], rb[j], rg[j], rr[j]);      // cost function
             }
         }
 
-        return sum / sqrt(255*255 + 255*255+255*255);      // normalize to winsize*1.0
+        return sum;
     }
 
-    float eukl(cv::Vec3b l, cv::Vec3b r) {
+    MYBM_INLINE float eukl(cv::Vec3b l, cv::Vec3b r) {
         float a = l[0] - r[0];
         float b = l[1] - r[1];
         float c = l[2] - r[2];
@@ -82,9 +261,22 @@ public:
     ~RGBCost() {}
 };
 
-class FloatCost : public CostFunction {
+class FloatCost : public BlockKernelCost<FloatCost> {
 public:
-    FloatCost(cv::Mat left, cv::Mat right, float lambda) : CostFunction(left, right, lambda) {}
+    PaddedImage lpad, rpad;
+
+    FloatCost(cv::Mat left, cv::Mat right, float lambda) : BlockKernelCost<FloatCost>(left, right, lambda), lpad(left), rpad(right) {}
+
+    // left/right rows are converted by the strip before prepareRows()
+    FloatCost(cv::Mat left, cv::Mat right, float lambda, DeferRows defer) : BlockKernelCost<FloatCost>(left, right, lambda) {
+        lpad.allocate(left, defer.pad);
+        rpad.allocate(right, defer.pad);
+    }
+
+    void prepareRows(int y0, int y1) {
+        lpad.fill(y0, y1);
+        rpad.fill(y0, y1);
+    }
 
     bool imageType(cv::Mat left, cv::Mat right) {
         assert(left.type() == right.type() && "imgL imgR types not equal");
@@ -93,15 +285,20 @@ public:
         return true;
     }
 
+    void reserve(int m) {
+        lpad.reserve(m);
+        rpad.reserve(m);
+    }
+
     // aggregate over a ROI of input images
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for (int i = y - margin; i <= y + margin; ++i) {
-            float* lptr = left.ptr<float>(i);
-            float* rptr = right.ptr<float>(i);
+        for (int i = y - m; i <= y + m; ++i) {
+            const float* lptr = lpad.row<float>(0, i);
+            const float* rptr = rpad.row<float>(0, i);
 
-            for ( int j = -margin ; j <= margin; ++j) {
-                sum += abs(lptr[x1 + j] - rptr[x2 + j]);      // cost function
+            for ( int j = -m ; j <= m; ++j) {
+                sum += std::abs(lptr[x1 + j] - rptr[x2 + j]);      // cost function, float abs (no int truncation)
             }
         }
 
@@ -109,14 +306,24 @@ public:
     }
 };
 
-class CondHistCost : public CostFunction {
+class CondHistCost : public BlockKernelCost<CondHistCost> {
 public:
-    cv::Mat nuLeft, nuRight;
-    CondHistCost(cv::Mat left, cv::Mat right, float lambda) : CostFunction(left, right, lambda) {
-        cv::Mat histl = condHist(left, 3);
-        nuLeft = switchColors(left, histl);
-        cv::Mat histr = condHist(right, 3);
-        nuRight = switchColors(right, histr);
+    PaddedImage lpad, rpad;     // switched colors
+
+    CondHistCost(cv::Mat left, cv::Mat right, float lambda) : BlockKernelCost<CondHistCost>(left, right, lambda) {
+        TRACE_SCOPE("preprocess/CondHistCost");
+
+        // left and right concurrently
+        TaskGraph graph;
+        graph.add("task/condhist", [&]() {
+            cv::Mat histl = condHist(left, 3);
+            lpad.create(switchColors(left, histl));
+        });
+        graph.add("task/condhist", [&]() {
+            cv::Mat histr = condHist(right, 3);
+            rpad.create(switchColors(right, histr));
+        });
+        graph.run();
     }
 
     bool imageType(cv::Mat left, cv::Mat right) {
@@ -126,15 +333,20 @@ public:
         return true;
     }
 
+    void reserve(int m) {
+        lpad.reserve(m);
+        rpad.reserve(m);
+    }
+
     // aggregate over a ROI of input images
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for (int i = y - margin; i <= y + margin; ++i) {
-            float* lptr = nuLeft.ptr<float>(i);
-            float* rptr = nuRight.ptr<float>(i);
+        for (int i = y - m; i <= y + m; ++i) {
+            const float* lptr = lpad.row<float>(0, i);
+            const float* rptr = rpad.row<float>(0, i);
 
-            for ( int j = -margin ; j <= margin; ++j) {
-                sum += abs(lptr[x1 + j] - rptr[x2 + j]);      // cost function
+            for ( int j = -m ; j <= m; ++j) {
+                sum += std::abs(lptr[x1 + j] - rptr[x2 + j]);      // cost function, float abs (no int truncation)
             }
         }
 
@@ -143,9 +355,22 @@ public:
 };
 
 
-class GrayCost : public CostFunction {
+class GrayCost : public BlockKernelCost<GrayCost> {
 public:
-    GrayCost(cv::Mat left, cv::Mat right, float lambda) : CostFunction(left, right, lambda) {}
+    PaddedImage lpad, rpad;
+
+    GrayCost(cv::Mat left, cv::Mat right, float lambda) : BlockKernelCost<GrayCost>(left, right, lambda), lpad(left), rpad(right) {}
+
+    // left/right rows are converted by the strip before prepareRows()
+    GrayCost(cv::Mat left, cv::Mat right, float lambda, DeferRows defer) : BlockKernelCost<GrayCost>(left, right, lambda) {
+        lpad.allocate(left, defer.pad);
+        rpad.allocate(right, defer.pad);
+    }
+
+    void prepareRows(int y0, int y1) {
+        lpad.fill(y0, y1);
+        rpad.fill(y0, y1);
+    }
 
     bool imageType(cv::Mat left, cv::Mat right) {
         assert(left.type() == right.type() && "imgL imgR types not equal");
@@ -154,14 +379,19 @@ public:
         return true;
     }
 
+    void reserve(int m) {
+        lpad.reserve(m);
+        rpad.reserve(m);
+    }
+
     // aggregate over a ROI of input images
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for (int i = y - margin; i <= y + margin; ++i) {
-            uchar* lptr = left.ptr<uchar>(i);
-            uchar* rptr = right.ptr<uchar>(i);
+        for (int i = y - m; i <= y + m; ++i) {
+            const uchar* lptr = lpad.row<uchar>(0, i);
+            const uchar* rptr = rpad.row<uchar>(0, i);
 
-            for ( int j = -margin; j <= margin; ++j) {
+            for ( int j = -m; j <= m; ++j) {
                 sum += abs(lptr[x1 + j] - rptr[x2 + j]);      // cost function
             }
         }
@@ -170,19 +400,89 @@ public:
     }
 };
 
-class GradientCost : public CostFunction {
+// mutual information, per pixel costs from a 256 x 256 table (see mutualinfo.h), gray images
+class MICost : public BlockKernelCost<MICost> {
+public:
+    cv::Mat table;      // [left][right] intensity, CV_32F in [0, 1]
+    PaddedImage lpad, rpad;
+
+    MICost(cv::Mat left, cv::Mat right, float lambda, int levels = 3) : BlockKernelCost<MICost>(left, right, lambda), lpad(left), rpad(right) {
+        TRACE_SCOPE("preprocess/MICost");
+        table = mutualInformationTable(left, right, levels);
+    }
+
+    MICost(cv::Mat left, cv::Mat right, cv::Mat table, float lambda) : BlockKernelCost<MICost>(left, right, lambda), lpad(left), rpad(right) {
+        assert(table.type() == CV_32F && table.rows == 256 && table.cols == 256 && table.isContinuous());
+        this->table = table;
+    }
+
+    bool imageType(cv::Mat left, cv::Mat right) {
+        assert(left.type() == right.type() && "imgL imgR types not equal");
+        assert(left.type() == CV_8UC1 && "img type not supported");
+
+        return true;
+    }
+
+    void reserve(int m) {
+        lpad.reserve(m);
+        rpad.reserve(m);
+    }
+
+    // aggregate over a ROI of input images
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
+        const float* t = table.ptr<float>(0);
+        float sum = 0;
+        for (int i = y - m; i <= y + m; ++i) {
+            const uchar* lptr = lpad.row<uchar>(0, i);
+            const uchar* rptr = rpad.row<uchar>(0, i);
+
+            for ( int j = -m; j <= m; ++j) {
+                sum += t[lptr[x1 + j] * 256 + rptr[x2 + j]];      // cost function
+            }
+        }
+
+        return sum / (blocksize*blocksize);
+    }
+};
+
+class GradientCost : public BlockKernelCost<GradientCost> {
 public:
-    cv::Mat l_grad;   // 3 channel float
-    cv::Mat r_grad;   // 3 channel float
+    PaddedImage l_grad;   // 3 planes float
+    PaddedImage r_grad;   // 3 planes float
+    cv::Mat l_angles, r_angles;     // DeferRows only
+
+    GradientCost(const cv::Mat left, const cv::Mat right, float lambda) : BlockKernelCost<GradientCost>(left, right, lambda) {
+        TRACE_SCOPE("preprocess/GradientCost");
 
-    GradientCost(const cv::Mat left, const cv::Mat right, float lambda) : CostFunction(left, right, lambda) {
-        l_grad = getRGBGradientAngle(left);
-        r_grad = getRGBGradientAngle(right);
+        // left and right concurrently
+        TaskGraph graph;
+        graph.add("task/gradient", [&]() { l_grad.create(getRGBGradientAngle(left)); });
+        graph.add("task/gradient", [&]() { r_grad.create(getRGBGradientAngle(right)); });
+        graph.run();
 
         //displayGradientPic(l_grad);
         //displayGradientPic(r_grad);
     }
 
+    GradientCost(const cv::Mat left, const cv::Mat right, float lambda, DeferRows defer) : BlockKernelCost<GradientCost>(left, right, lambda) {
+        l_angles.create(left.size(), CV_32FC3);
+        r_angles.create(right.size(), CV_32FC3);
+        l_grad.allocate(l_angles, defer.pad);
+        r_grad.allocate(r_angles, defer.pad);
+    }
+
+    // the 3x3 filters read one row above and below the strip
+    void prepareRows(int y0, int y1) {
+        int a = std::max(y0 - 1, 0);
+        int b = std::min(y1 + 1, left.rows);
+
+        cv::Mat l = l_angles.rowRange(y0, y1), r = r_angles.rowRange(y0, y1);
+        getRGBGradientAngle(left.rowRange(a, b)).rowRange(y0 - a, y1 - a).copyTo(l);
+        getRGBGradientAngle(right.rowRange(a, b)).rowRange(y0 - a, y1 - a).copyTo(r);
+        l_grad.fill(y0, y1);
+        r_grad.fill(y0, y1);
+    }
+
     bool imageType(cv::Mat left, cv::Mat right) {
         assert(left.type() == right.type() && "imgL imgR types not equal");
         assert(left.type() == CV_8UC3 && "img type not supported");
@@ -190,38 +490,43 @@ public:
         return true;
     }
 
+    void reserve(int m) {
+        l_grad.reserve(m);
+        r_grad.reserve(m);
+    }
+
     // aggregate over a ROI of input images
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
+        const float norm = 1.0f / 441.672955f;     // 1 / sqrt(255*255 + 255*255 + 255*255), normalize to winSize * 1.0
         float sum = 0;
-        for (int i = y - margin; i <= y + margin; ++i) {
-            cv::Vec3f* lptr = l_grad.ptr<cv::Vec3f>(i);
-            cv::Vec3f* rptr = r_grad.ptr<cv::Vec3f>(i);
-
-            for ( int j = -margin; j <= margin; ++j) {
-                sum += eukl(lptr[x1 + j], rptr[x2 + j]);      // cost function
+        for (int i = y - m; i <= y + m; ++i) {
+            const float* l0 = l_grad.row<float>(0, i) + x1;
+            const float* l1 = l_grad.row<float>(1, i) + x1;
+            const float* l2 = l_grad.row<float>(2, i) + x1;
+            const float* r0 = r_grad.row<float>(0, i) + x2;
+            const float* r1 = r_grad.row<float>(1, i) + x2;
+            const float* r2 = r_grad.row<float>(2, i) + x2;
+
+            for ( int j = -m; j <= m; ++j) {
+                float d = eukl(l0[j] - r0[j], l1[j] - r1[j], l2[j] - r2[j]) * norm;      // cost function
+                sum += robust ? RobustLUT::eval(d / lambda) : d;
             }
         }
 
-        return sum / sqrt(255*255 + 255*255 + 255*255);      // normalize to winSize * 1.0
+        return sum;
     }
 
-    float eukl(cv::Vec3f l, cv::Vec3f r) {
-        float a = l[0] - r[0];
-        float b = l[1] - r[1];
-        float c = l[2] - r[2];
+    MYBM_INLINE float eukl(float a, float b, float c) {
         return std::sqrt(a*a + b*b + c*c);
     }
-
-    ~GradientCost() {
-        l_grad.release();
-        r_grad.release();
-    }
 };
 
 class CensusCost : public CostFunction {
 public:
     int censusWindow;
     int censusMargin;
+    PaddedImage lpad, rpad;
+
     CensusCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : CostFunction(left, right, lambda) {
         // census.... nimmt einen Block
         this->censusWindow = censusWindow;
@@ -229,6 +534,8 @@ public:
 
         this->normWin = censusWindow * censusWindow;
         // nimmt einen Block
+        lpad.create(left, std::max(censusMargin, (int) PaddedImage::DEFAULT_PAD));
+        rpad.create(right, std::max(censusMargin, (int) PaddedImage::DEFAULT_PAD));
     }
 
     bool imageType(cv::Mat left, cv::Mat right) {
@@ -242,8 +549,8 @@ public:
         unsigned int diff = 0;
 
         for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
-            uchar* lptr = left.ptr<uchar>(i);
-            uchar* rptr = right.ptr<uchar>(i);
+            const uchar* lptr = lpad.row<uchar>(0, i);
+            const uchar* rptr = rpad.row<uchar>(0, i);
 
             for(int j = -censusMargin; j <= censusMargin; ++j) {
                 bool t1 = (c1 < lptr[x1 + j]);
@@ -265,19 +572,20 @@ public:
             for(int j = -margin; j <= margin; ++j)
                 sum += census(x1 + j, x2 + j, i, lptr[x1 + j], rptr[x2 + j]);
         }*/
-        uchar *lptr = left.ptr<uchar>(y);
-        uchar *rptr = right.ptr<uchar>(y);
+        const uchar *lptr = lpad.row<uchar>(0, y);
+        const uchar *rptr = rpad.row<uchar>(0, y);
         sum = census(x1, x2, y, lptr[x1], rptr[x2]);
         return sum / normWin;
     }
 };
 
-class CensusFloatCost : public CostFunction {
+class CensusFloatCost : public BlockKernelCost<CensusFloatCost> {
 public:
     int censusWindow;
     int censusMargin;
+    PaddedImage lpad, rpad;
 
-    CensusFloatCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : CostFunction(left, right, lambda) {
+    CensusFloatCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : BlockKernelCost<CensusFloatCost>(left, right, lambda), lpad(left), rpad(right) {
         // census.... nimmt einen Block
         this->censusWindow = censusWindow;
         this->censusMargin = censusWindow / 2;
@@ -290,12 +598,18 @@ public:
         return true;
     }
 
+    // census windows around every pixel of the block window
+    void reserve(int m) {
+        lpad.reserve(m + censusMargin);
+        rpad.reserve(m + censusMargin);
+    }
+
     unsigned int census(int x1, int x2, int y, float c1, float c2) {
         unsigned int diff = 0;
 
         for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
-            float* lptr = left.ptr<float>(i);
-            float* rptr = right.ptr<float>(i);
+            const float* lptr = lpad.row<float>(0, i);
+            const float* rptr = rpad.row<float>(0, i);
 
             for(int j = -censusMargin; j <= censusMargin; ++j) {
                 bool t1 = (c1 < lptr[x1 + j]);
@@ -308,28 +622,29 @@ public:
         return diff;
     }
 
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for(int i = y - margin; i <= y + margin; ++i) {
-            float *lptr = left.ptr<float>(i);
-            float *rptr = right.ptr<float>(i);
+        for(int i = y - m; i <= y + m; ++i) {
+            const float *lptr = lpad.row<float>(0, i);
+            const float *rptr = rpad.row<float>(0, i);
 
-            for(int j = -margin; j <= margin; ++j)
+            for(int j = -m; j <= m; ++j)
                 sum += census(x1 + j, x2 + j, i, lptr[x1 + j], rptr[x2 + j]);
         }
-        float *lptr = left.ptr<float>(y);
-        float *rptr = right.ptr<float>(y);
+        //float *lptr = left.ptr<float>(y);
+        //float *rptr = right.ptr<float>(y);
         //sum = census(x1, x2, y, lptr[x1], rptr[x2]);
         return sum / (censusWindow*censusWindow*lambda);
     }
 };
 
-class RGBCensusCost : public CostFunction {
+class RGBCensusCost : public BlockKernelCost<RGBCensusCost> {
 public:
     int censusWindow;
     int censusMargin;
+    PaddedImage lpad, rpad;     // planar B, G, R
 
-    RGBCensusCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : CostFunction(left, right, lambda) {
+    RGBCensusCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : BlockKernelCost<RGBCensusCost>(left, right, lambda), lpad(left), rpad(right) {
         // census.... nimmt einen Block
         this->censusWindow = censusWindow;
         this->censusMargin = censusWindow / 2;
@@ -344,20 +659,27 @@ public:
         return true;
     }
 
-    unsigned int census(int x1, int x2, int y, cv::Vec3b c1, cv::Vec3b c2) {
+    // census windows around every pixel of the block window
+    void reserve(int m) {
+        lpad.reserve(m + censusMargin);
+        rpad.reserve(m + censusMargin);
+    }
+
+    // census of the channel planes around (x1, y) / (x2, y)
+    unsigned int census(int x1, int x2, int y) {
         unsigned int diff = 0;
 
-        for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
-            cv::Vec3b* lptr = left.ptr<cv::Vec3b>(i);
-            cv::Vec3b* rptr = right.ptr<cv::Vec3b>(i);
+        for(int ch = 0; ch < 3; ++ch) {
+            uchar c1 = lpad.row<uchar>(ch, y)[x1];
+            uchar c2 = rpad.row<uchar>(ch, y)[x2];
 
-            for(int j = -censusMargin; j <= censusMargin; ++j) {
-                cv::Vec3b cl = lptr[x1 + j];
-                cv::Vec3b cr = rptr[x2 + j];
+            for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
+                const uchar* lptr = lpad.row<uchar>(ch, i);
+                const uchar* rptr = rpad.row<uchar>(ch, i);
 
-                for(int ch = 0; ch < 3; ++ch) {
-                    bool t1 = (c1[ch] < cl[ch]);
-                    bool t2 = (c2[ch] < cr[ch]);
+                for(int j = -censusMargin; j <= censusMargin; ++j) {
+                    bool t1 = (c1 < lptr[x1 + j]);
+                    bool t2 = (c2 < rptr[x2 + j]);
 
                     if(t1 != t2) diff++;
                 }
@@ -367,17 +689,12 @@ public:
         return diff;
     }
 
-    float aggregate(int x1, int x2, int y) {
+    MYBM_INLINE float window(int x1, int x2, int y, int m) {
         float sum = 0;
-        for(int i = y - margin; i <= y + margin; ++i) {
-            cv::Vec3b *lptr = left.ptr<cv::Vec3b>(i);
-            cv::Vec3b *rptr = right.ptr<cv::Vec3b>(i);
-
-            for(int j = -margin; j <= margin; ++j)
-                sum += census(x1 + j, x2 + j, i, lptr[x1 + j], rptr[x2 + j]);
+        for(int i = y - m; i <= y + m; ++i) {
+            for(int j = -m; j <= m; ++j)
+                sum += census(x1 + j, x2 + j, i);
         }
-        //cv::Vec3b *lptr = left.ptr<cv::Vec3b>(y);
-        //cv::Vec3b *rptr = right.ptr<cv::Vec3b>(y);
 
         return sum / normCost;
     }
@@ -391,8 +708,8 @@ public:
     float normCost;
     float normWin;
 
-    cv::Mat l_grad;
-    cv::Mat r_grad;
+    PaddedImage l_grad;     // 3 planes float
+    PaddedImage r_grad;
 
     RGBGradCensusCost(cv::Mat left, cv::Mat right, int censusWindow, float lambda) : CostFunction(left, right, lambda) {
         // census.... nimmt einen Block
@@ -400,8 +717,14 @@ public:
         this->censusMargin = censusWindow / 2;
         normWin = censusWindow*censusWindow*3;
         // nimmt einen Block
-        l_grad = getRGBGradientAngle(left);
-        r_grad = getRGBGradientAngle(right);
+        TRACE_SCOPE("preprocess/RGBGradCensusCost");
+        int pad = std::max(censusMargin, (int) PaddedImage::DEFAULT_PAD);
+
+        // left and right concurrently
+        TaskGraph graph;
+        graph.add("task/gradient", [&]() { l_grad.create(getRGBGradientAngle(left), pad); });
+        graph.add("task/gradient", [&]() { r_grad.create(getRGBGradientAngle(right), pad); });
+        graph.run();
     }
 
     bool imageType(cv::Mat left, cv::Mat right) {
@@ -411,20 +734,21 @@ public:
         return true;
     }
 
-    unsigned int census(int x1, int x2, int y, cv::Vec3f c1, cv::Vec3f c2) {
+    // census of the gradient planes around (x1, y) / (x2, y)
+    unsigned int census(int x1, int x2, int y) {
         unsigned int diff = 0;
 
-        for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
-            cv::Vec3f* lptr = l_grad.ptr<cv::Vec3f>(i);
-            cv::Vec3f* rptr = r_grad.ptr<cv::Vec3f>(i);
+        for(int ch = 0; ch < 3; ++ch) {
+            float c1 = l_grad.row<float>(ch, y)[x1];
+            float c2 = r_grad.row<float>(ch, y)[x2];
 
-            for(int j = -censusMargin; j <= censusMargin; ++j) {
-                cv::Vec3f cl = lptr[x1 + j];
-                cv::Vec3f cr = rptr[x2 + j];
+            for(int i = y - censusMargin; i <= y + censusMargin; ++i) {
+                const float* lptr = l_grad.row<float>(ch, i);
+                const float* rptr = r_grad.row<float>(ch, i);
 
-                for(int ch = 0; ch < 3; ++ch) {
-                    bool t1 = (c1[ch] < cl[ch]);
-                    bool t2 = (c2[ch] < cr[ch]);
+                for(int j = -censusMargin; j <= censusMargin; ++j) {
+                    bool t1 = (c1 < lptr[x1 + j]);
+                    bool t2 = (c2 < rptr[x2 + j]);
 
                     if(t1 != t2) diff++;
                 }
@@ -435,30 +759,40 @@ public:
     }
 
     float aggregate(int x1, int x2, int y) {
-        float sum = 0;
-        /*for(int i = y - margin; i <= y + margin; ++i) {
-            cv::Vec3f *lptr = l_grad.ptr<cv::Vec3f>(i);
-            cv::Vec3f *rptr = r_grad.ptr<cv::Vec3f>(i);
-
-            for(int j = -margin; j <= margin; ++j)
-                sum += census(x1 + j, x2 + j, i, lptr[x1 + j], rptr[x2 + j]);
-        }*/
-        cv::Vec3f *lptr = l_grad.ptr<cv::Vec3f>(y);
-        cv::Vec3f *rptr = r_grad.ptr<cv::Vec3f>(y);
-
-        sum = census(x1, x2, y, lptr[x1], rptr[x2]);
-        return sum / normWin;
+        return census(x1, x2, y) / normWin;
     }
 };
 
+class DSIWriter;
+class DSIReader;
+class PointCloudWriter;
+
 class BlockMatching
 {
 public:
     std::vector<CostFunction*> functions;
 
-    // stats
-    std::vector<float> mins;
-    std::vector<float> maxs;
+    // dynamic programming penalties
+    float occlusionSouth;
+    float occlusionEast;
+    bool markOcclusions;    // occluded pixels get 0 (invalid), e.g. for fillOcclusions
+
+    // disparity search range, x1 - x2 (left minus right column). A range smaller than the
+    // scanline gives banded disparity space images (see DSIBand), only the band is aggregated
+    // and the dynamic programming runs inside it
+    static const int FULL_RANGE = 1 << 20;
+    int minDisparity;
+    int maxDisparity;
+
+    DSIWriter* dsiOut;      // if set, every disparity space image is saved
+    PointCloudWriter* cloudOut;     // if set, compute() reprojects finished scanlines in batches
+
+    // deferred row local preprocessing running in strips (see addCostFunctions with a block size).
+    // compute() starts on the first scanlines and waits per scanline for the rows it reads, prepare()
+    // waits for all of it. stripPad: border of the deferred images, larger margins wait as well
+    TaskGraph preprocessing;
+    int stripPad;
+    void finishPreprocessing();         // rethrows exceptions of the strips
 
     BlockMatching();
     ~BlockMatching();
@@ -467,8 +801,21 @@ public:
     void lineSAD(cv::Mat left, cv::Mat right, int blocksize, cv::Mat &map, int y);
     //static void getSimularityMap(cv::Mat left, cv::Mat right, int blocksize, std::vector<int> entries);
     cv::Mat combineDisparitySpace(std::vector<cv::Mat> &maps, std::vector<float> &factors);
-    cv::Mat disparitySpace(cv::Size imageSize, int blocksize, int y);
+    DSIBand sectionBand(cv::Range r1, cv::Range r2) const;
+    cv::Mat disparitySpace(cv::Size imageSize, int blocksize, int y, DSIBand &band);
+    cv::Mat disparitySpace(int y, cv::Range r1, cv::Range r2, DSIBand &band);
+    void disparitySpaces(cv::Size imageSize, int blocksize, int y, std::vector<cv::Mat> &maps, DSIBand &band);
+    void setDisparityRange(int minDisparity, int maxDisparity);
+    void prepare(int blocksize);
+    void computeLine(cv::Size imageSize, int blocksize, int y, cv::Mat &disparity);
+    void computeLines(cv::Size imageSize, int blocksize, const std::vector<int> &lines, cv::Mat &disparity);
     cv::Mat compute(cv::Size imageSize, int blocksize);
+    cv::Mat computeFromCosts(DSIReader &dsi);
+
+    // sparse queries
+    void computeSpan(cv::Size imageSize, int blocksize, int y, int x0, int x1, int maxDisparity, int pad, cv::Mat &line);
+    cv::Mat computeROI(cv::Size imageSize, int blocksize, cv::Rect roi, int maxDisparity = -1, int pad = 16);
+    std::vector<ushort> computePoints(cv::Size imageSize, int blocksize, const std::vector<cv::Point> &points, int maxDisparity = -1, int pad = 16);
 };
 
 #endif // BLOCKMATCHING_H
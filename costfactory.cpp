@@ -0,0 +1,260 @@
+#include "costfactory.h"
+#include "taskgraph.h"
+
+#include <sstream>
+
+using namespace std;
+using namespace cv;
+
+static const int CENSUS_WINDOW = 3;
+static const int STRIP_ROWS = 32;       // deferred preprocessing
+
+static Mat toGray(Mat image) {
+    if(image.type() == CV_8UC1) return image;
+
+    Mat gray;
+    cvtColor(image, gray, COLOR_BGR2GRAY);
+    return gray;
+}
+
+static Mat toFloat(Mat image) {
+    Mat f;
+    toGray(image).convertTo(f, CV_32F);
+    return f;
+}
+
+static bool needsFloat(const string &name) {
+    return name == "float" || name == "censusfloat";
+}
+
+static bool needsGray(const string &name) {
+    return name == "gray" || name == "mi" || name == "census" || needsFloat(name);
+}
+
+// left/right in the variants the cost functions take, derived once
+struct CostInputs {
+    Mat left, right;
+    Mat grayLeft, grayRight;
+    Mat floatLeft, floatRight;
+};
+
+// 0 for unknown names
+static CostFunction* createCost(const string &name, float lambda, const CostInputs &in) {
+    if(name == "rgb")              return new RGBCost(in.left, in.right, lambda);
+    else if(name == "gray")        return new GrayCost(in.grayLeft, in.grayRight, lambda);
+    else if(name == "mi")          return new MICost(in.grayLeft, in.grayRight, lambda);
+    else if(name == "float")       return new FloatCost(in.floatLeft, in.floatRight, lambda);
+    else if(name == "condhist")    return new CondHistCost(in.left, in.right, lambda);
+    else if(name == "gradient")    return new GradientCost(in.left, in.right, lambda);
+    else if(name == "census")      return new CensusCost(in.grayLeft, in.grayRight, CENSUS_WINDOW, lambda);
+    else if(name == "censusfloat") return new CensusFloatCost(in.floatLeft, in.floatRight, CENSUS_WINDOW, lambda);
+    else if(name == "rgbcensus")   return new RGBCensusCost(in.left, in.right, CENSUS_WINDOW, lambda);
+    else if(name == "gradcensus")  return new RGBGradCensusCost(in.left, in.right, CENSUS_WINDOW, lambda);
+
+    return 0;
+}
+
+// preprocessing of a row only reads rows close to it (conversions, 3x3 filters)
+static bool rowLocal(const string &name) {
+    return name == "rgb" || name == "gray" || name == "float" || name == "gradient";
+}
+
+// row local functions, allocated only (see CostFunction::DeferRows)
+static CostFunction* createDeferredCost(const string &name, float lambda, const CostInputs &in, int pad) {
+    CostFunction::DeferRows defer(pad);
+
+    if(name == "rgb")              return new RGBCost(in.left, in.right, lambda, defer);
+    else if(name == "gray")        return new GrayCost(in.grayLeft, in.grayRight, lambda, defer);
+    else if(name == "float")       return new FloatCost(in.floatLeft, in.floatRight, lambda, defer);
+    else if(name == "gradient")    return new GradientCost(in.left, in.right, lambda, defer);
+
+    return 0;
+}
+
+bool addCostFunction(BlockMatching &bm, const string &name, float lambda, Mat left, Mat right) {
+    assert(left.type() == CV_8UC3 && right.type() == CV_8UC3);
+
+    CostInputs in;
+    in.left = left;
+    in.right = right;
+    if(needsGray(name)) {
+        in.grayLeft = toGray(left);
+        in.grayRight = toGray(right);
+    }
+    if(needsFloat(name)) {
+        in.floatLeft = toFloat(in.grayLeft);
+        in.floatRight = toFloat(in.grayRight);
+    }
+
+    CostFunction* f = createCost(name, lambda, in);
+    if(!f) {
+        cout << "unknown cost function: " << name << endl;
+        return false;
+    }
+
+    bm.functions.push_back(f);
+    return true;
+}
+
+/* Row local functions with their preprocessing in strips on bm.preprocessing, which keeps running
+ * in the background: a strip converts its gray/float rows, prepares its rows of every function and
+ * publishes them (rowsReady). A failing strip aborts the waiting matcher, which rethrows.
+ */
+static void deferCostFunctions(BlockMatching &bm, const vector<string> &names, const vector<float> &lambdas,
+                               Mat left, Mat right, int blocksize) {
+    bool gray = false, floats = false;
+    for(size_t i = 0; i < names.size(); ++i) {
+        gray = gray || needsGray(names[i]);
+        floats = floats || needsFloat(names[i]);
+    }
+
+    CostInputs in;
+    in.left = left;
+    in.right = right;
+    if(gray) {
+        in.grayLeft.create(left.size(), CV_8U);
+        in.grayRight.create(right.size(), CV_8U);
+    }
+    if(floats) {
+        in.floatLeft.create(left.size(), CV_32F);
+        in.floatRight.create(right.size(), CV_32F);
+    }
+
+    int pad = max(blocksize / 2, (int) PaddedImage::DEFAULT_PAD);
+
+    vector<CostFunction*> created;
+    for(size_t i = 0; i < names.size(); ++i) {
+        created.push_back(createDeferredCost(names[i], lambdas[i], in, pad));
+        created.back()->rowsReady.reset(left.rows, STRIP_ROWS);
+    }
+
+    for(int y0 = 0; y0 < left.rows; y0 += STRIP_ROWS) {
+        int y1 = min(y0 + STRIP_ROWS, left.rows);
+
+        bm.preprocessing.add("task/strip", [=]() {
+            try {
+                // ROI headers of the shared images, written in place (float implies gray)
+                if(gray) {
+                    Mat grayLeft = in.grayLeft.rowRange(y0, y1), grayRight = in.grayRight.rowRange(y0, y1);
+                    cvtColor(left.rowRange(y0, y1), grayLeft, COLOR_BGR2GRAY);
+                    cvtColor(right.rowRange(y0, y1), grayRight, COLOR_BGR2GRAY);
+
+                    if(floats) {
+                        Mat floatLeft = in.floatLeft.rowRange(y0, y1), floatRight = in.floatRight.rowRange(y0, y1);
+                        grayLeft.convertTo(floatLeft, CV_32F);
+                        grayRight.convertTo(floatRight, CV_32F);
+                    }
+                }
+
+                for(size_t i = 0; i < created.size(); ++i)
+                    created[i]->prepareRows(y0, y1);
+            }
+            catch(...) {
+                for(size_t i = 0; i < created.size(); ++i)
+                    created[i]->rowsReady.abort();
+                throw;
+            }
+
+            for(size_t i = 0; i < created.size(); ++i)
+                created[i]->rowsReady.finish(y0);
+        });
+    }
+
+    bm.functions.insert(bm.functions.end(), created.begin(), created.end());
+    bm.stripPad = pad;
+    bm.preprocessing.start();
+}
+
+/* All functions of a spec are set up as one task graph: the gray/float versions of left and right
+ * and every cost function (with its own left/right preprocessing) run concurrently, a function
+ * starts once the inputs it takes are derived. bm.functions keeps the order of the spec.
+ * With a block size and only row local functions the preprocessing is deferred into strips that
+ * overlap with compute() instead (deferCostFunctions). Whole image functions (condhist, mi, the
+ * census variants) are a barrier: the spec is set up completely before matching can start.
+ */
+bool addCostFunctions(BlockMatching &bm, const string &spec, Mat left, Mat right, int blocksize) {
+    assert(left.type() == CV_8UC3 && right.type() == CV_8UC3);
+
+    vector<string> names;
+    vector<float> lambdas;
+
+    stringstream ss(spec);
+    string item;
+
+    while(getline(ss, item, ',')) {
+        if(item.empty()) continue;
+
+        string name = item;
+        float lambda = 1.0f;
+
+        size_t colon = item.find(':');
+        if(colon != string::npos) {
+            name = item.substr(0, colon);
+            lambda = atof(item.substr(colon + 1).c_str());
+        }
+
+        names.push_back(name);
+        lambdas.push_back(lambda);
+    }
+
+    if(names.empty()) return false;
+
+    // strips of a previous spec still use the matcher
+    bm.finishPreprocessing();
+
+    bool deferred = blocksize > 0;
+    for(size_t i = 0; i < names.size(); ++i)
+        deferred = deferred && rowLocal(names[i]);
+
+    if(deferred) {
+        deferCostFunctions(bm, names, lambdas, left, right, blocksize);
+        return true;
+    }
+
+    bool gray = false, floats = false;
+    for(size_t i = 0; i < names.size(); ++i) {
+        gray = gray || needsGray(names[i]);
+        floats = floats || needsFloat(names[i]);
+    }
+
+    CostInputs in;
+    in.left = left;
+    in.right = right;
+
+    TaskGraph graph;
+    vector<int> grayTasks, floatTasks;
+
+    if(gray) {
+        grayTasks.push_back(graph.add("task/gray", [&]() { in.grayLeft = toGray(left); }));
+        grayTasks.push_back(graph.add("task/gray", [&]() { in.grayRight = toGray(right); }));
+    }
+    if(floats) {
+        floatTasks.push_back(graph.add("task/float", [&]() { in.floatLeft = toFloat(in.grayLeft); }, grayTasks[0]));
+        floatTasks.push_back(graph.add("task/float", [&]() { in.floatRight = toFloat(in.grayRight); }, grayTasks[1]));
+    }
+
+    vector<CostFunction*> created(names.size(), (CostFunction*) 0);
+    for(size_t i = 0; i < names.size(); ++i) {
+        const vector<int> &deps = needsFloat(names[i]) ? floatTasks : (needsGray(names[i]) ? grayTasks : vector<int>());
+        graph.add("task/cost", [&, i]() { created[i] = createCost(names[i], lambdas[i], in); }, deps);
+    }
+
+    try {
+        graph.run();
+    }
+    catch(...) {
+        for(size_t i = 0; i < created.size(); ++i) delete created[i];
+        throw;
+    }
+
+    for(size_t i = 0; i < created.size(); ++i) {
+        if(created[i]) continue;
+
+        cout << "unknown cost function: " << names[i] << endl;
+        for(size_t k = 0; k < created.size(); ++k) delete created[k];
+        return false;
+    }
+
+    bm.functions.insert(bm.functions.end(), created.begin(), created.end());
+    return true;
+}
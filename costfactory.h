@@ -0,0 +1,19 @@
+#ifndef COSTFACTORY_H
+#define COSTFACTORY_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "blockmatching.h"
+
+/* Cost functions by name, for tools and configuration strings.
+ * spec: comma separated list of name[:lambda], e.g. "rgb,census:0.5"
+ * names: rgb, gray, mi, float, condhist, gradient, census, censusfloat, rgbcensus, gradcensus
+ * left/right are 8 bit BGR images, gray/float versions are derived as needed.
+ * blocksize > 0: the block size the matcher will use. Row local functions (rgb, gray, float,
+ * gradient) then return right away and prepare their rows in the background while compute() starts
+ * matching (see BlockMatching::preprocessing), any other function in the spec waits for all of it.
+ */
+bool addCostFunction(BlockMatching &bm, const std::string &name, float lambda, cv::Mat left, cv::Mat right);
+bool addCostFunctions(BlockMatching &bm, const std::string &spec, cv::Mat left, cv::Mat right, int blocksize = 0);
+
+#endif // COSTFACTORY_H
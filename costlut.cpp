@@ -0,0 +1,46 @@
+#include "costlut.h"
+#include "memstats.h"
+
+using namespace std;
+
+static vector<float> buildRobust() {
+    vector<float> t(RobustLUT::BINS + 1);
+    for(int i = 0; i <= RobustLUT::BINS; ++i)
+        t[i] = 1 - exp(-(double) i * RobustLUT::RANGE / RobustLUT::BINS);
+    return t;
+}
+
+const float* RobustLUT::table() {
+    static const vector<float> t = buildRobust();
+    return &t[0];
+}
+
+static vector<int> buildSquares() {
+    vector<int> t(2*255 + 1);
+    for(int d = -255; d <= 255; ++d)
+        t[d + 255] = d * d;
+    return t;
+}
+
+DistanceLUT::DistanceLUT() {
+    static const vector<int> squares = buildSquares();
+    sq = &squares[255];
+    memStage = 0;
+}
+
+DistanceLUT::~DistanceLUT() {
+    MemStats::remove(memStage, table.size() * sizeof(float));
+}
+
+void DistanceLUT::build(float norm, float lambda, bool robust) {
+    if(table.empty()) {
+        table.resize(BINS);
+        memStage = MemStats::add(BINS * sizeof(float));
+    }
+
+    for(int i = 0; i < BINS; ++i) {
+        double sum = i < EXACT ? i : ((i - EXACT + (EXACT >> SHIFT)) << SHIFT) + ((1 << SHIFT) - 1) / 2.0;
+        float d = (float) (sqrt(sum) / norm);
+        table[i] = robust ? 1 - (float) exp(-d / lambda) : d;
+    }
+}
@@ -0,0 +1,64 @@
+#ifndef COSTLUT_H
+#define COSTLUT_H
+
+#include <vector>
+#include <cmath>
+
+/* Lookup tables for the inner loops of the cost functions, no sqrt()/exp() per pixel pair. */
+
+// robust penalty 1 - exp(-x), sampled on [0, RANGE) with linear interpolation (error < 1e-5)
+class RobustLUT
+{
+public:
+    static const int BINS = 4096;
+    static const int RANGE = 16;        // 1 - exp(-16) is 1 in float
+
+    static const float* table();        // BINS + 1 samples
+
+    static float eval(float x) {
+        if(x < 0) return 1 - std::exp(-x);
+
+        float f = x * (BINS / RANGE);
+        if(f >= BINS) return 1.0f;
+
+        int i = (int) f;
+        const float* t = table();
+        return t[i] + (f - i) * (t[i + 1] - t[i]);
+    }
+};
+
+/* per pixel cost of two 8 bit 3 channel pixels, indexed by the sum of the squared channel
+ * differences (<= 3*255*255): euclidean distance / norm, or p() of it (robust).
+ * Sums below EXACT have their own entry, larger ones share aligned bins of 2^SHIFT sampled at
+ * the bin center (distance error < 0.5 / norm, 16 KB instead of 780 KB for one entry per sum).
+ * Has to be rebuilt when lambda changes.
+ */
+class DistanceLUT
+{
+public:
+    static const int EXACT = 1024;
+    static const int SHIFT = 6;
+    static const int BINS = 4096;       // index(3*255*255) < BINS
+
+    const int* sq;                      // squared difference, sq[d] for d in -255..255
+
+    DistanceLUT();
+    ~DistanceLUT();
+
+    void build(float norm, float lambda, bool robust);
+
+    static int index(int sum) {
+        return sum < EXACT ? sum : (sum >> SHIFT) + (EXACT - (EXACT >> SHIFT));
+    }
+
+    // planar channels
+    float cost(int l0, int l1, int l2, int r0, int r1, int r2) const {
+        return table[index(sq[l0 - r0] + sq[l1 - r1] + sq[l2 - r2])];
+    }
+
+private:
+    std::vector<float> table;
+    const char* memStage;               // MemStats stage of the table
+};
+
+#endif // COSTLUT_H
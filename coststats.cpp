@@ -0,0 +1,187 @@
+#include "coststats.h"
+
+#include <vector>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+// log2 histogram: BINS_PER_OCTAVE bins per octave over [2^MIN_EXP, 2^(MIN_EXP + OCTAVES))
+// bin 0 also holds zero/smaller costs, the last bin larger ones
+static const int MIN_EXP = -16;
+static const int OCTAVES = 32;
+static const int BINS_PER_OCTAVE = 4;
+static const int BINS = OCTAVES * BINS_PER_OCTAVE;
+
+struct FunctionStats {
+    long count;
+    double sum;
+    float min;
+    float max;
+    vector<long> histogram;
+    vector<float> rowMin;       // per scanline, +inf: no costs
+    vector<float> rowMax;
+
+    FunctionStats() : count(0), sum(0), min(numeric_limits<float>::max()), max(-numeric_limits<float>::max()), histogram(BINS, 0) {}
+
+    void addRow(int y, float lo, float hi) {
+        if(y >= (int) rowMin.size()) {
+            rowMin.resize(y + 1, numeric_limits<float>::max());
+            rowMax.resize(y + 1, -numeric_limits<float>::max());
+        }
+        rowMin[y] = std::min(rowMin[y], lo);
+        rowMax[y] = std::max(rowMax[y], hi);
+    }
+
+    void merge(const FunctionStats &o) {
+        count += o.count;
+        sum += o.sum;
+        min = std::min(min, o.min);
+        max = std::max(max, o.max);
+
+        for(int i = 0; i < BINS; ++i)
+            histogram[i] += o.histogram[i];
+
+        for(size_t y = 0; y < o.rowMin.size(); ++y) {
+            if(o.rowMin[y] <= o.rowMax[y]) addRow((int) y, o.rowMin[y], o.rowMax[y]);
+        }
+    }
+};
+
+// one accumulator per thread, adding does not need a lock
+struct StatsBuffer {
+    vector<FunctionStats> functions;
+};
+
+bool CostStats::enabled = false;
+
+static mutex buffersMutex;
+static vector<StatsBuffer*> buffers;
+
+static StatsBuffer* localBuffer() {
+    static thread_local StatsBuffer* local = 0;
+
+    if(!local) {
+        lock_guard<mutex> lock(buffersMutex);
+        local = new StatsBuffer();
+        buffers.push_back(local);
+    }
+
+    return local;
+}
+
+static inline int histogramBin(float cost) {
+    if(!(cost > 0)) return 0;
+
+    int bin = (int) std::floor((std::log2(cost) - MIN_EXP) * BINS_PER_OCTAVE);
+    return std::min(std::max(bin, 0), BINS - 1);
+}
+
+static inline float binStart(int bin) {
+    return std::exp2((float) bin / BINS_PER_OCTAVE + MIN_EXP);
+}
+
+void CostStats::add(int function, int y, const float* costs, int n) {
+    if(n <= 0) return;
+
+    StatsBuffer* buf = localBuffer();
+    if(function >= (int) buf->functions.size()) buf->functions.resize(function + 1);
+    FunctionStats &s = buf->functions[function];
+
+    float lo = costs[0], hi = costs[0];
+    double sum = 0;
+    for(int i = 0; i < n; ++i) {
+        float c = costs[i];
+        lo = std::min(lo, c);
+        hi = std::max(hi, c);
+        sum += c;
+        s.histogram[histogramBin(c)]++;
+    }
+
+    s.count += n;
+    s.sum += sum;
+    s.min = std::min(s.min, lo);
+    s.max = std::max(s.max, hi);
+    s.addRow(y, lo, hi);
+}
+
+void CostStats::clear() {
+    lock_guard<mutex> lock(buffersMutex);
+
+    for(size_t b = 0; b < buffers.size(); ++b)
+        buffers[b]->functions.clear();
+}
+
+// all threads merged, per function
+static void collect(vector<FunctionStats> &stats) {
+    lock_guard<mutex> lock(buffersMutex);
+
+    stats.clear();
+    for(size_t b = 0; b < buffers.size(); ++b) {
+        const vector<FunctionStats> &f = buffers[b]->functions;
+        if(f.size() > stats.size()) stats.resize(f.size());
+
+        for(size_t i = 0; i < f.size(); ++i)
+            stats[i].merge(f[i]);
+    }
+}
+
+void CostStats::printSummary(ostream &out) {
+    vector<FunctionStats> stats;
+    collect(stats);
+
+    for(size_t i = 0; i < stats.size(); ++i) {
+        const FunctionStats &s = stats[i];
+        if(!s.count) continue;
+
+        out << "cost function " << i << ": " << s.count << " costs, mean " << s.sum / s.count
+            << ", min " << s.min << ", max " << s.max << endl;
+
+        // non empty bins as [lower bound, count]
+        out << "  histogram:";
+        for(int b = 0; b < BINS; ++b) {
+            if(s.histogram[b]) out << " [" << (b ? binStart(b) : 0.0f) << " " << s.histogram[b] << "]";
+        }
+        out << endl;
+    }
+}
+
+bool CostStats::writeRows(const string &path) {
+    vector<FunctionStats> stats;
+    collect(stats);
+
+    ofstream out(path.c_str());
+    if(!out) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    size_t rows = 0;
+    out << "y";
+    for(size_t i = 0; i < stats.size(); ++i) {
+        out << ",min" << i << ",max" << i;
+        rows = std::max(rows, stats[i].rowMin.size());
+    }
+    out << "\n";
+
+    for(size_t y = 0; y < rows; ++y) {
+        bool any = false;
+        for(size_t i = 0; i < stats.size(); ++i)
+            any = any || (y < stats[i].rowMin.size() && stats[i].rowMin[y] <= stats[i].rowMax[y]);
+        if(!any) continue;
+
+        out << y;
+        for(size_t i = 0; i < stats.size(); ++i) {
+            if(y < stats[i].rowMin.size() && stats[i].rowMin[y] <= stats[i].rowMax[y])
+                out << "," << stats[i].rowMin[y] << "," << stats[i].rowMax[y];
+            else
+                out << ",,";
+        }
+        out << "\n";
+    }
+
+    return true;
+}
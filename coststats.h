@@ -0,0 +1,31 @@
+#ifndef COSTSTATS_H
+#define COSTSTATS_H
+
+#include <string>
+#include <ostream>
+
+/* Statistics of the aggregated costs per cost function: count, mean, min, max, a histogram
+ * (log2 bins, quarter octaves) and min/max per scanline.
+ * COST_STATS(function, y, costs, n) adds one row of n costs while CostStats::enabled is set
+ * (one branch per row when disabled). The accumulators are per thread, printSummary() and
+ * writeRows() merge them. Compiled out completely with MYBM_NO_COST_STATS (cmake -DMYBM_COST_STATS=OFF).
+ */
+class CostStats
+{
+public:
+    static bool enabled;
+
+    static void add(int function, int y, const float* costs, int n);
+    static void clear();
+
+    static void printSummary(std::ostream &out);
+    static bool writeRows(const std::string &path);     // csv: y, min/max per function
+};
+
+#ifdef MYBM_NO_COST_STATS
+#define COST_STATS(function, y, costs, n) do {} while(0)
+#else
+#define COST_STATS(function, y, costs, n) do { if(CostStats::enabled) CostStats::add(function, y, costs, n); } while(0)
+#endif
+
+#endif // COSTSTATS_H
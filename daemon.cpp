@@ -0,0 +1,236 @@
+#include "daemon.h"
+#include "costfactory.h"
+#include "stripio.h"
+#include "dsifile.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+static bool connectTo(int fd, const string &path, bool bindSocket) {
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    if(path.size() >= sizeof(addr.sun_path)) {
+        cout << "socket path too long: " << path << endl;
+        return false;
+    }
+    strcpy(addr.sun_path, path.c_str());
+
+    int r = bindSocket ? ::bind(fd, (sockaddr*) &addr, sizeof(addr)) : ::connect(fd, (sockaddr*) &addr, sizeof(addr));
+    if(r != 0) {
+        cout << "could not " << (bindSocket ? "bind" : "connect to") << " " << path << endl;
+        return false;
+    }
+
+    return true;
+}
+
+static bool readLine(int fd, string &line) {
+    line.clear();
+    char c;
+    while(true) {
+        ssize_t n = ::read(fd, &c, 1);
+        if(n <= 0) return !line.empty();
+        if(c == '\n') return true;
+        line += c;
+    }
+}
+
+static bool writeLine(int fd, const string &line) {
+    string data = line + "\n";
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = send(fd, data.data() + done, data.size() - done, MSG_NOSIGNAL);      // client may be gone
+        if(n <= 0) return false;
+        done += n;
+    }
+
+    return true;
+}
+
+// changes whenever the file is replaced or rewritten, empty if it does not exist
+static string fileStamp(const string &path) {
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0) return "";
+    return format("%lld.%09ld:%lld:%llu", (long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec,
+                  (long long) st.st_size, (unsigned long long) st.st_ino);
+}
+
+MatchServer::MatchServer(const string &socketPath) {
+    this->socketPath = socketPath;
+    requests = 0;
+    fd = -1;
+    session = 0;
+}
+
+MatchServer::~MatchServer() {
+    delete session;
+
+    if(fd >= 0) {
+        ::close(fd);
+        unlink(socketPath.c_str());
+    }
+}
+
+bool MatchServer::run() {
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        cout << "could not create socket" << endl;
+        return false;
+    }
+
+    unlink(socketPath.c_str());         // stale socket of a previous run
+    if(!connectTo(fd, socketPath, true)) return false;
+    if(listen(fd, 16) != 0) {
+        cout << "could not listen on " << socketPath << endl;
+        return false;
+    }
+
+    cout << "listening on " << socketPath << endl;
+
+    bool quit = false;
+    while(!quit) {
+        int client = accept(fd, 0, 0);
+        if(client < 0) continue;
+
+        string request;
+        if(readLine(client, request)) {
+            quit = (request == "quit");
+            writeLine(client, quit ? "ok" : handle(request));
+        }
+        ::close(client);
+    }
+
+    return true;
+}
+
+string MatchServer::handle(const string &request) {
+    stringstream args(request);
+    string command;
+    args >> command;
+
+    requests++;
+
+    // a failing request must not take the server down
+    try {
+        if(command == "ping") return "ok";
+        if(command == "match") return match(args);
+    }
+    catch(const std::exception &e) {
+        resetSession();
+        return string("error ") + e.what();
+    }
+    catch(...) {
+        resetSession();
+        return "error internal error";
+    }
+
+    return "error unknown command " + command;
+}
+
+// the matcher may be half set up after an exception
+void MatchServer::resetSession() {
+    delete session;
+    session = 0;
+    sessionKey = "";
+}
+
+string MatchServer::match(istream &args) {
+    string leftFile, rightFile, outFile;
+    if(!(args >> leftFile >> rightFile >> outFile)) return "error usage: match <left> <right> <out> [key=value ...]";
+
+    int blocksize = 3;
+    string costs = "rgb";
+    float occlusionSouth = 1.0f, occlusionEast = 1.0f;
+    int rawWidth = 0, rawHeight = 0, rawChannels = 3;
+
+    string option;
+    while(args >> option) {
+        size_t eq = option.find('=');
+        string key = option.substr(0, eq);
+        string value = (eq == string::npos) ? "" : option.substr(eq + 1);
+
+        if(key == "b") blocksize = atoi(value.c_str());
+        else if(key == "costs") costs = value;
+        else if(key == "occ") sscanf(value.c_str(), "%f,%f", &occlusionSouth, &occlusionEast);
+        else if(key == "raw") sscanf(value.c_str(), "%d,%d,%d", &rawWidth, &rawHeight, &rawChannels);
+        else return "error unknown option " + key;
+    }
+
+    if(blocksize < 1 || blocksize % 2 == 0) return "error b has to be odd and at least 1";
+
+    string key = leftFile + "|" + fileStamp(leftFile) + "|" + rightFile + "|" + fileStamp(rightFile) + "|" + costs + "|"
+               + format("%dx%dx%d", rawWidth, rawHeight, rawChannels);
+
+    // warm matcher: inputs unchanged, cost functions keep their preprocessing
+    if(!session || key != sessionKey) {
+        TRACE_SCOPE("load");
+
+        Mat left, right;
+        if(rawWidth > 0) {
+            StripReader l, r;
+            if(!l.openRaw(leftFile, rawWidth, rawHeight, rawChannels) || !r.openRaw(rightFile, rawWidth, rawHeight, rawChannels))
+                return "error could not open inputs";
+
+            left = l.rows(0, rawHeight);
+            right = r.rows(0, rawHeight);
+        }
+        else {
+            left = imread(leftFile);
+            right = imread(rightFile);
+        }
+
+        if(left.empty() || right.empty()) return "error could not read inputs";
+        if(left.size() != right.size()) return "error image size not equal";
+
+        delete session;
+        session = new BlockMatching();
+        sessionKey = "";
+
+        if(!addCostFunctions(*session, costs, left, right, blocksize)) return "error unknown cost function in " + costs;
+
+        sessionKey = key;
+        sessionSize = left.size();
+    }
+
+    if(sessionSize.width <= 2 * blocksize || sessionSize.height <= 2 * blocksize) return "error image too small";
+
+    session->occlusionSouth = occlusionSouth;
+    session->occlusionEast = occlusionEast;
+
+    int64 start = getTickCount();
+    Mat disparity = session->compute(sessionSize, blocksize);
+    double seconds = (getTickCount() - start) / getTickFrequency();
+
+    TRACE_SCOPE("output");
+
+    bool written;
+    if(outFile.size() > 4 && outFile.compare(outFile.size() - 4, 4, ".dsp") == 0) written = writeDisparity(outFile, disparity);
+    else written = imwrite(outFile, disparity);
+
+    if(!written) return "error could not write " + outFile;
+
+    return format("ok %d %d %f", disparity.cols, disparity.rows, seconds);
+}
+
+bool sendRequest(const string &socketPath, const string &request, string &reply) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) {
+        cout << "could not create socket" << endl;
+        return false;
+    }
+
+    bool ok = connectTo(fd, socketPath, false) && writeLine(fd, request) && readLine(fd, reply);
+    ::close(fd);
+
+    return ok;
+}
@@ -0,0 +1,52 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "blockmatching.h"
+
+/* Server mode: requests over a Unix domain socket, one text line per request and reply.
+ *
+ *   match <left> <right> <out> [b=<blocksize>] [costs=<spec>] [occ=<south>,<east>] [raw=<w>,<h>,<channels>]
+ *   ping
+ *   quit
+ *
+ * Inputs are image files or, with raw=, raw 8 bit files (e.g. in /dev/shm) which are memory mapped.
+ * The disparity is written to out: *.dsp in the memory mapped raw format (see dsifile.h, put it in
+ * /dev/shm for a shared memory hand over), anything else through imwrite (16 bit).
+ * Replies: "ok <width> <height> <seconds>" or "error <message>", also for exceptions of a request.
+ * The block size b has to be odd.
+ *
+ * The process, OpenCV and its thread pool stay warm. The matcher of the last request is kept with
+ * its preprocessed cost functions and reused while inputs and costs are unchanged. Inputs are
+ * compared by path and file identity (mtime in nanoseconds, size, inode), so a raw file rewritten
+ * in place within the same second is reloaded.
+ */
+class MatchServer
+{
+public:
+    std::string socketPath;
+    int requests;
+
+    MatchServer(const std::string &socketPath);
+    ~MatchServer();
+
+    bool run();                                         // until "quit"
+    std::string handle(const std::string &request);
+
+private:
+    int fd;
+
+    // warm matcher of the last request
+    std::string sessionKey;
+    cv::Size sessionSize;
+    BlockMatching* session;
+
+    std::string match(std::istream &args);
+    void resetSession();
+};
+
+// client side: send one request line, reply without newline
+bool sendRequest(const std::string &socketPath, const std::string &request, std::string &reply);
+
+#endif // DAEMON_H
@@ -1,4 +1,5 @@
 #include "dpmat.h"
+#include "trace.h"
 
 using namespace cv;
 using namespace std;
@@ -12,9 +13,10 @@ DPmat::DPmat() {
 //    (3) initialize travelpath for last row (only east direction)
 // (4) calculate paths till last sink (last entry) till xLast - 1, yLast - 1
 // (-) save all (chosen) directions along the way
-void DPmat::preCalc(Mat &matrix, Mat &sum, Mat &dirs) {
-    float occlusion_south = 1.0f;
-    float occlusion_east = 1.0f;
+// occlusion_south/occlusion_east weight the occlusion directions (penalties)
+void DPmat::preCalc(Mat &matrix, Mat &sum, Mat &dirs, float occlusion_south, float occlusion_east) {
+    TRACE_SCOPE("DPmat::preCalc");
+
     sum = Mat::zeros(matrix.rows, matrix.cols, matrix.type());         // not initialized with zero, should not be a problem,
     dirs = Mat::zeros(matrix.rows, matrix.cols, CV_16U);               // because traversion is pre initialized with borders
 
@@ -76,6 +78,70 @@ void DPmat::preCalc(Mat &matrix, Mat &sum, Mat &dirs) {
     }
 }
 
+/*
+ * Banded disparity space (see DSIBand): same recursion as the square one, entries outside the
+ * band do not exist. Rows are done bottom up, every row from its last entry (east successor first).
+ * Entries of the last row / last column only continue along it while it stays in the band,
+ * otherwise they end the path.
+ */
+void DPmat::preCalc(Mat &matrix, const DSIBand &band, Mat &sum, Mat &dirs, float occlusion_south, float occlusion_east) {
+    if(!band.banded()) {
+        preCalc(matrix, sum, dirs, occlusion_south, occlusion_east);
+        return;
+    }
+
+    TRACE_SCOPE("DPmat::preCalc");
+    assert(matrix.type() == CV_32F && matrix.cols == band.width);
+
+    const float inf = numeric_limits<float>::infinity();
+    sum.create(matrix.rows, band.width, CV_32F);
+    sum.setTo(Scalar(inf));
+    dirs = Mat::zeros(matrix.rows, band.width, CV_16U);
+
+    int rowLast = matrix.rows - 1;
+    int colLast = band.cols - 1;
+
+    for(int y = rowLast; y >= 0; --y) {
+        float* sum_ptr = sum.ptr<float>(y);
+        const float* sum_south_ptr = (y < rowLast) ? sum.ptr<float>(y + 1) : 0;
+        const float* mat_ptr = matrix.ptr<float>(y);
+        ushort* dirs_ptr = dirs.ptr<ushort>(y);
+
+        // k with 0 <= x2 < cols
+        int kStart = max(0, -y - band.first);
+        int kEnd = min(band.width, band.cols - y - band.first);
+
+        for(int k = kEnd - 1; k >= kStart; --k) {
+            int x2 = y + band.first + k;
+            float m = mat_ptr[k];
+
+            if(y < rowLast && x2 < colLast) {
+                float s = (k > 0) ? sum_south_ptr[k - 1] * occlusion_south : inf;      // (y+1, x2)     occlusion dir
+                float se = sum_south_ptr[k];                                            // (y+1, x2+1)
+                float e = (k + 1 < band.width) ? sum_ptr[k + 1] * occlusion_east : inf; // (y, x2+1)     occlusion dir
+
+                float p = min(s, min(se, e));
+                sum_ptr[k] = p + m;
+
+                if(p == s) dirs_ptr[k] = 1;   // occlusion
+                if(p == se) dirs_ptr[k] = 2;   // math
+                if(p == e) dirs_ptr[k] = 3;   // occlusion
+            }
+            else if(y < rowLast && k > 0) {         // last col, south
+                sum_ptr[k] = m * occlusion_south + sum_south_ptr[k - 1];
+                dirs_ptr[k] = 1;
+            }
+            else if(x2 < colLast && k + 1 < band.width) {       // last row, east
+                sum_ptr[k] = m * occlusion_east + sum_ptr[k + 1];
+                dirs_ptr[k] = 3;
+            }
+            else {
+                sum_ptr[k] = m;     // end of the path
+            }
+        }
+    }
+}
+
 /*
  * Traversion backtracking. Walks back the direction matrix (dirs).
  * 1 - south        add x2      occluded
@@ -85,7 +151,18 @@ void DPmat::preCalc(Mat &matrix, Mat &sum, Mat &dirs) {
  * x1 linkes Bild, x2 Rechtes Bild
  */
 void DPmat::disparityFromDirs(Mat &sum, Mat &dirs, Mat &disp, int line, int offset) {
+    disparityFromDirs(sum, dirs, disp, line, offset, offset);
+}
+
+/*
+ * Backtracking for a section of the disparity space: x1 + offset1 and x2 + offset2 are image columns.
+ */
+void DPmat::disparityFromDirs(Mat &sum, Mat &dirs, Mat &disp, int line, int offset1, int offset2, bool markOcclusions) {
+    TRACE_SCOPE("DPmat::backtrack");
+
     assert(dirs.type() == CV_16U);
+    int offset = offset1;
+    int shift = offset2 - offset1;     // image disparity = (x2 - x1) + shift
 
     // wir bekommen jetzt einen index x, y
     int rowLast = dirs.rows - 1;
@@ -110,7 +187,7 @@ void DPmat::disparityFromDirs(Mat &sum, Mat &dirs, Mat &disp, int line, int offs
     x2 = minIndex;
 
     // safe x1, x2 as disparity match
-    ushort disparity = abs(x2 - x1);
+    ushort disparity = abs(x2 - x1 + shift);
     ushort* disp_ptr = disp.ptr<ushort>(line);
 
     disp_ptr[x1 + offset] = disparity;
@@ -120,23 +197,101 @@ void DPmat::disparityFromDirs(Mat &sum, Mat &dirs, Mat &disp, int line, int offs
 
         if(d == 1) {    // 1 = down, skipping left index, left got occloded (occlusion from right)
             x1++;
-            if(lastval >= 0) disp_ptr[x1 + offset] = lastval;   // dips[line, x1 + offset] = lastval
-            //disp_ptr[x1 + offset] = 0;
+            if(markOcclusions) disp_ptr[x1 + offset] = 0;
+            else if(lastval >= 0) disp_ptr[x1 + offset] = lastval;   // dips[line, x1 + offset] = lastval
         }
         if(d == 2) { // match
             // next entry will be match
             x1++;
             x2++;
-            disparity = abs(x2 - x1);
+            disparity = abs(x2 - x1 + shift);
 
             disp_ptr[x1 + offset] = disparity;
             lastval = disparity;
         }
         if(d == 3) { // 2 = right, skipping right index, occlusion don't care..
             x2++;
-            if(lastval >= 0) disp_ptr[x1 + offset] = lastval;   // dips[line, x1 + offset] = lastval
-            //disp_ptr[x1 + offset]= 0;
+            if(!markOcclusions && lastval >= 0) disp_ptr[x1 + offset] = lastval;   // dips[line, x1 + offset] = lastval
+        }
+    }
+}
+
+/*
+ * Backtracking in a banded disparity space (see DSIBand). Starts at (0, 0) if it is inside the band,
+ * otherwise at the cheapest entry of the first row or first column (the disparity range leaves out 0).
+ * x1 + offset1 and x2 + offset2 are image columns.
+ */
+void DPmat::disparityFromDirs(Mat &sum, Mat &dirs, const DSIBand &band, Mat &disp, int line, int offset1, int offset2,
+                              bool markOcclusions) {
+    if(!band.banded()) {
+        disparityFromDirs(sum, dirs, disp, line, offset1, offset2, markOcclusions);
+        return;
+    }
+
+    TRACE_SCOPE("DPmat::backtrack");
+    assert(dirs.type() == CV_16U && dirs.cols == band.width);
+
+    int shift = offset2 - offset1;     // image disparity = (x2 - x1) + shift
+    int rowLast = dirs.rows - 1;
+    int colLast = band.cols - 1;
+
+    int x1 = 0;
+    int k = -band.first;
+
+    if(k < 0 || k >= band.width) {
+        float minVal = numeric_limits<float>::infinity();
+        x1 = -1;
+
+        // first row
+        for(int j = max(0, -band.first); j < min(band.width, band.cols - band.first); ++j) {
+            if(sum.at<float>(0, j) < minVal) {
+                minVal = sum.at<float>(0, j);
+                x1 = 0;
+                k = j;
+            }
+        }
+
+        // first column, x2 = 0
+        for(int y = 1; y <= rowLast; ++y) {
+            int j = -y - band.first;
+            if(j < 0) break;
+            if(j < band.width && sum.at<float>(y, j) < minVal) {
+                minVal = sum.at<float>(y, j);
+                x1 = y;
+                k = j;
+            }
+        }
+
+        if(x1 < 0) return;      // band outside of the section
+    }
+
+    int x2 = x1 + band.first + k;
+    ushort* disp_ptr = disp.ptr<ushort>(line);
+
+    int lastval = -1;
+    disp_ptr[x1 + offset1] = abs(x2 - x1 + shift);
+
+    while(x1 < rowLast && x2 < colLast) {
+        ushort d = dirs.at<ushort>(x1, k);
+
+        if(d == 1) {            // south, left pixel occluded
+            x1++;
+            k--;
+            if(markOcclusions) disp_ptr[x1 + offset1] = 0;
+            else if(lastval >= 0) disp_ptr[x1 + offset1] = lastval;
+        }
+        else if(d == 2) {       // match
+            x1++;
+            x2++;
+            lastval = abs(x2 - x1 + shift);
+            disp_ptr[x1 + offset1] = lastval;
+        }
+        else if(d == 3) {       // east
+            x2++;
+            k++;
+            if(!markOcclusions && lastval >= 0) disp_ptr[x1 + offset1] = lastval;
         }
+        else break;
     }
 }
 
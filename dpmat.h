@@ -3,12 +3,34 @@
 
 #include "essentials.h"
 
+/* Layout of a disparity space image (rows x1, columns x2 < cols).
+ * square (width 0): entry [x1][x2]
+ * banded: entry [x1][k] is x2 = x1 + first + k, k < width; only entries with 0 <= x2 < cols exist.
+ * The dynamic programming of a banded image stays inside the band: south (x1 + 1, k - 1),
+ * east (x1, k + 1), south-east (x1 + 1, k).
+ */
+struct DSIBand {
+    int first;
+    int width;
+    int cols;
+
+    DSIBand() : first(0), width(0), cols(0) {}
+    DSIBand(int first, int width, int cols) : first(first), width(width), cols(cols) {}
+
+    bool banded() const { return width > 0; }
+};
+
 class DPmat
 {
 public:
     DPmat();
-    static void preCalc(cv::Mat &matrix, cv::Mat &sum, cv::Mat &dirs);
+    static void preCalc(cv::Mat &matrix, cv::Mat &sum, cv::Mat &dirs, float occlusion_south = 1.0f, float occlusion_east = 1.0f);
+    static void preCalc(cv::Mat &matrix, const DSIBand &band, cv::Mat &sum, cv::Mat &dirs, float occlusion_south, float occlusion_east);
     static void disparityFromDirs(cv::Mat &sum, cv::Mat &dirs, cv::Mat &disp, int line, int offset);
+    // markOcclusions: left pixels of south (occlusion) steps get 0 instead of the last matched disparity
+    static void disparityFromDirs(cv::Mat &sum, cv::Mat &dirs, cv::Mat &disp, int line, int offset1, int offset2, bool markOcclusions = false);
+    static void disparityFromDirs(cv::Mat &sum, cv::Mat &dirs, const DSIBand &band, cv::Mat &disp, int line, int offset1, int offset2,
+                                  bool markOcclusions = false);
     static void drawPath(cv::Mat &sum, cv::Mat &dirs, cv::Mat &image);
 };
 
@@ -0,0 +1,174 @@
+#include "dsifile.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+static const char DSI_MAGIC[8] = { 'M', 'Y', 'B', 'M', 'D', 'S', 'I', '1' };
+static const char DSP_MAGIC[8] = { 'M', 'Y', 'B', 'M', 'D', 'S', 'P', '1' };
+
+static size_t entriesPerRow(const DSIHeader &h) {
+    int band = h.banded ? h.maxDisparity - h.minDisparity + 1 : h.cols;
+    return (size_t) h.cols * band;
+}
+
+bool DSIWriter::open(const string &path, Size imageSize, int blocksize, int minDisparity, int maxDisparity) {
+    int margin = blocksize / 2;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DSI_MAGIC, sizeof(header.magic));
+    header.width = imageSize.width;
+    header.height = imageSize.height;
+    header.blocksize = blocksize;
+    header.firstRow = margin;
+    header.rows = imageSize.height - 2 * margin;
+    header.cols = imageSize.width - 2 * margin;
+    header.minDisparity = max(minDisparity, -(header.cols - 1));
+    header.maxDisparity = min(maxDisparity, header.cols - 1);
+    header.banded = (header.minDisparity > -(header.cols - 1) || header.maxDisparity < header.cols - 1) ? 1 : 0;
+
+    assert(header.rows > 0 && header.cols > 0);
+    if(header.minDisparity > header.maxDisparity) {
+        cout << path << ": disparity range is outside of the image" << endl;
+        return false;
+    }
+
+    size_t size = sizeof(DSIHeader) + entriesPerRow(header) * header.rows * sizeof(float);
+    if(!file.create(path, size)) return false;
+
+    memcpy(file.data, &header, sizeof(header));
+
+    return true;
+}
+
+void DSIWriter::write(int y, Mat &map) {
+    assert(file.isOpen());
+    int band = header.banded ? header.maxDisparity - header.minDisparity + 1 : header.cols;
+    assert(map.type() == CV_32F && map.rows == header.cols && map.cols == band);
+
+    int i = y - header.firstRow;
+    assert(i >= 0 && i < header.rows);
+
+    size_t rowBytes = entriesPerRow(header) * sizeof(float);
+    size_t offset = sizeof(DSIHeader) + i * rowBytes;
+    float* dst = (float*) (file.data + offset);
+
+    // the disparity space image already has the stored layout
+    for(int x1 = 0; x1 < header.cols; ++x1)
+        memcpy(dst + (size_t) x1 * band, map.ptr<float>(x1), band * sizeof(float));
+
+    // written scanlines go to disk, keeps the resident size at one scanline
+    file.release(offset, rowBytes);
+}
+
+void DSIWriter::close() {
+    file.close();
+}
+
+bool DSIReader::open(const string &path) {
+    if(!file.open(path)) return false;
+
+    if(file.size < sizeof(DSIHeader) || memcmp(file.data, DSI_MAGIC, sizeof(DSI_MAGIC)) != 0) {
+        cout << path << ": not a mybm cost volume" << endl;
+        close();
+        return false;
+    }
+
+    memcpy(&header, file.data, sizeof(header));
+
+    // the stored scanlines have to fit into the width x height disparity map
+    const DSIHeader &h = header;
+    bool valid = h.rows > 0 && h.cols > 0 && (h.banded == 0 || h.banded == 1)
+        && h.minDisparity >= -(h.cols - 1) && h.minDisparity <= h.maxDisparity && h.maxDisparity <= h.cols - 1
+        && h.blocksize >= 1 && h.width == h.cols + 2 * (h.blocksize / 2)
+        && h.firstRow >= h.blocksize / 2 && h.firstRow <= h.height - h.rows;
+    if(!valid) {
+        cout << path << ": invalid cost volume header" << endl;
+        close();
+        return false;
+    }
+
+    if(sizeof(DSIHeader) + entriesPerRow(header) * header.rows * sizeof(float) != file.size) {
+        cout << path << ": cost volume size does not match its header" << endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+Mat DSIReader::row(int i) {
+    assert(file.isOpen() && i >= 0 && i < header.rows);
+
+    size_t rowBytes = entriesPerRow(header) * sizeof(float);
+    size_t offset = sizeof(DSIHeader) + i * rowBytes;
+    float* src = (float*) (file.data + offset);
+
+    // previous scanlines are done, next one will be needed
+    if(i > 0) file.release(offset - rowBytes, rowBytes);
+    if(i + 1 < header.rows) file.prefetch(offset + rowBytes, rowBytes);
+
+    return Mat(header.cols, (int) (entriesPerRow(header) / header.cols), CV_32F, src);
+}
+
+DSIBand DSIReader::band() const {
+    if(!header.banded) return DSIBand();
+    return DSIBand(-header.maxDisparity, header.maxDisparity - header.minDisparity + 1, header.cols);
+}
+
+void DSIReader::close() {
+    file.close();
+}
+
+bool writeDisparity(const string &path, Mat disparity) {
+    assert(disparity.type() == CV_16U || disparity.type() == CV_32F);
+
+    DisparityHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DSP_MAGIC, sizeof(header.magic));
+    header.width = disparity.cols;
+    header.height = disparity.rows;
+    header.type = disparity.type();
+
+    size_t rowBytes = disparity.cols * disparity.elemSize();
+
+    MappedFile file;
+    if(!file.create(path, sizeof(header) + rowBytes * disparity.rows)) return false;
+
+    memcpy(file.data, &header, sizeof(header));
+    for(int y = 0; y < disparity.rows; ++y)
+        memcpy(file.data + sizeof(header) + rowBytes * y, disparity.ptr(y), rowBytes);
+
+    file.close();
+
+    return true;
+}
+
+Mat readDisparity(MappedFile &file, const string &path) {
+    if(!file.open(path)) return Mat();
+
+    DisparityHeader header;
+    if(file.size < sizeof(header) || memcmp(file.data, DSP_MAGIC, sizeof(DSP_MAGIC)) != 0) {
+        cout << path << ": not a mybm disparity map" << endl;
+        file.close();
+        return Mat();
+    }
+
+    memcpy(&header, file.data, sizeof(header));
+
+    if(header.type != CV_16U && header.type != CV_32F) {
+        cout << path << ": unsupported disparity type" << endl;
+        file.close();
+        return Mat();
+    }
+
+    Mat disparity(header.height, header.width, header.type, file.data + sizeof(header));
+    if(sizeof(header) + disparity.total() * disparity.elemSize() > file.size) {
+        cout << path << ": disparity map is truncated" << endl;
+        file.close();
+        return Mat();
+    }
+
+    return disparity;
+}
@@ -0,0 +1,69 @@
+#ifndef DSIFILE_H
+#define DSIFILE_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "mappedfile.h"
+#include "dpmat.h"
+
+/* On disk formats (little endian, 64 byte header, data 64 byte aligned), read and written via mmap.
+ *
+ * cost volume "MYBMDSI1": one disparity space image per scanline, float32.
+ *   square layout: cols x cols entries [x1][x2]
+ *   banded layout: cols x band entries [x1][k], x2 = x1 - maxDisparity + k, band = maxDisparity - minDisparity + 1,
+ *                  entries with x2 outside [0, cols) are unused
+ * disparity  "MYBMDSP1": width x height, CV_16U or CV_32F
+ */
+struct DSIHeader {
+    char magic[8];
+    int width;              // image size
+    int height;
+    int blocksize;
+    int firstRow;           // image row of the first stored scanline
+    int rows;               // stored scanlines
+    int cols;               // disparity space size (width - 2 * margin)
+    int minDisparity;       // band of stored entries (x1 - x2)
+    int maxDisparity;
+    int banded;             // 0 square, 1 banded layout
+    int reserved[5];
+};
+
+struct DisparityHeader {
+    char magic[8];
+    int width;
+    int height;
+    int type;               // CV_16U or CV_32F
+    int reserved[11];
+};
+
+class DSIWriter
+{
+public:
+    DSIHeader header;
+
+    bool open(const std::string &path, cv::Size imageSize, int blocksize, int minDisparity, int maxDisparity);
+    void write(int y, cv::Mat &map);        // scanline y (image coordinates), CV_32F cols x cols or cols x band
+    void close();
+
+private:
+    MappedFile file;
+};
+
+class DSIReader
+{
+public:
+    DSIHeader header;
+
+    bool open(const std::string &path);
+    cv::Mat row(int i);     // i-th stored scanline in the stored layout, zero copy
+    DSIBand band() const;
+    void close();
+
+private:
+    MappedFile file;
+};
+
+bool writeDisparity(const std::string &path, cv::Mat disparity);
+cv::Mat readDisparity(MappedFile &file, const std::string &path);      // zero copy, valid while file is open
+
+#endif // DSIFILE_H
@@ -201,3 +201,33 @@ cv::Mat switchColors(cv::Mat image, cv::Mat hist) {
 
     return nuImg;
 }
+
+cv::Mat adaptiveMargins(cv::Mat image, int minMargin, int maxMargin, float flat, float textured) {
+    assert(minMargin >= 0 && minMargin <= maxMargin && maxMargin < 256 && flat < textured);
+
+    cv::Mat gray;
+    if(image.channels() == 3) cvtColor(image, gray, COLOR_BGR2GRAY);
+    else gray = image;
+
+    // mean sobel magnitude over 5x5
+    cv::Mat gradX, gradY, mag;
+    Sobel(gray, gradX, CV_32F, 1, 0);
+    Sobel(gray, gradY, CV_32F, 0, 1);
+    magnitude(gradX, gradY, mag);
+    blur(mag, mag, Size(5, 5));
+
+    cv::Mat margins(image.size(), CV_8U);
+    float slope = (maxMargin - minMargin) / (textured - flat);
+
+    for(int y = 0; y < image.rows; ++y) {
+        const float* m = mag.ptr<float>(y);
+        uchar* out = margins.ptr<uchar>(y);
+
+        for(int x = 0; x < image.cols; ++x) {
+            float t = std::min(std::max(m[x], flat), textured);
+            out[x] = (uchar) cvRound(maxMargin - (t - flat) * slope);
+        }
+    }
+
+    return margins;
+}
@@ -4,6 +4,7 @@
 #include <vector>
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include "memstats.h"
 
 #define UINT24_RANGE 16777216
 
@@ -16,19 +17,22 @@ public:
 
     int* map;
     int* value;
+    const char* memStage;       // MemStats stage of map and value
 
     SimpleMap(int range)
     {
         map = new int[range];
         value = new int[range];
+        memStage = MemStats::add(2 * range * sizeof(int));
 
         counter = 0;
         this->range = range;
     }
 
     ~SimpleMap() {
-        delete map;
-        delete value;
+        delete[] map;
+        delete[] value;
+        MemStats::remove(memStage, 2 * range * sizeof(int));
     }
 
     int getIndex(int key) {
@@ -107,4 +111,8 @@ void blockCondHist(cv::Mat block, cv::Mat& hist, int c);
 cv::Mat condHist(cv::Mat image, int blocksize);
 cv::Mat switchColors(cv::Mat image, cv::Mat hist);
 
+// window margin per pixel for adaptive windows (CV_8U): maxMargin where the mean gradient magnitude
+// is below flat, minMargin above textured, linear in between
+cv::Mat adaptiveMargins(cv::Mat image, int minMargin, int maxMargin, float flat = 10.0f, float textured = 60.0f);
+
 #endif // FILTERS_H
@@ -0,0 +1,103 @@
+#include "incremental.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+IncrementalMatcher::IncrementalMatcher(int threshold, int context) {
+    this->threshold = threshold;
+    this->context = context;
+    prevBlocksize = 0;
+    stats.frame = 0;
+    stats.rows = 0;
+    stats.changedRows = 0;
+    stats.recomputedRows = 0;
+    stats.seconds = 0;
+}
+
+void IncrementalMatcher::reset() {
+    prevLeft.release();
+    prevRight.release();
+    prevDisparity.release();
+    prevBlocksize = 0;
+    stats.frame = 0;
+}
+
+// mark every row of cur which differs from prev by more than threshold in any channel
+void IncrementalMatcher::changedRows(Mat prev, Mat cur, vector<bool> &changed) {
+    size_t rowBytes = cur.cols * cur.elemSize();
+
+    for(int y = 0; y < cur.rows; ++y) {
+        if(changed[y]) continue;
+
+        const uchar* pptr = prev.ptr<uchar>(y);
+        const uchar* cptr = cur.ptr<uchar>(y);
+
+        if(threshold <= 0) {
+            changed[y] = memcmp(pptr, cptr, rowBytes) != 0;
+            continue;
+        }
+
+        for(size_t x = 0; x < rowBytes; ++x) {
+            if(abs(pptr[x] - cptr[x]) > threshold) {
+                changed[y] = true;
+                break;
+            }
+        }
+    }
+}
+
+Mat IncrementalMatcher::compute(BlockMatching &bm, Mat left, Mat right, int blocksize) {
+    assert(left.size() == right.size() && left.type() == right.type());
+    assert(left.depth() == CV_8U && "only 8 bit frames can be diffed");
+
+    int64 startTicks = getTickCount();
+
+    Size imageSize = left.size();
+    int margin = blocksize / 2;
+    int start = margin;
+    int stopH = imageSize.height - margin;
+    int band = margin + context;
+
+    bool full = prevDisparity.empty() || prevBlocksize != blocksize ||
+                prevLeft.size() != imageSize || prevLeft.type() != left.type();
+
+    // (1) diff both frames against their predecessors row by row
+    vector<bool> changed(imageSize.height, full);
+    if(!full) {
+        changedRows(prevLeft, left, changed);
+        changedRows(prevRight, right, changed);
+    }
+
+    // (2) prefix sum over changed input rows, so each scanline band is checked in O(1)
+    vector<int> prefix(imageSize.height + 1, 0);
+    for(int y = 0; y < imageSize.height; ++y)
+        prefix[y + 1] = prefix[y] + (changed[y] ? 1 : 0);
+
+    vector<int> lines;
+    for(int y = start; y < stopH; ++y) {
+        int lo = max(y - band, 0);
+        int hi = min(y + band + 1, imageSize.height);
+        if(prefix[hi] - prefix[lo] > 0) lines.push_back(y);
+    }
+
+    // (3) copy the unchanged scanlines, rematch the rest
+    Mat disparity = full ? Mat(Mat::zeros(imageSize, CV_16U)) : prevDisparity.clone();
+
+    bm.prepare(blocksize);
+    bm.computeLines(imageSize, blocksize, lines, disparity);
+
+    prevLeft = left.clone();
+    prevRight = right.clone();
+    prevDisparity = disparity;
+    prevBlocksize = blocksize;
+
+    stats.frame++;
+    stats.rows = stopH - start;
+    stats.changedRows = prefix[imageSize.height];
+    stats.recomputedRows = (int) lines.size();
+    stats.seconds = (getTickCount() - startTicks) / getTickFrequency();
+
+    return disparity.clone();
+}
@@ -0,0 +1,46 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "blockmatching.h"
+
+// per frame statistics of the incremental recompute
+struct IncrementalStats {
+    int frame;
+    int rows;               // scanlines the matcher works on (height - 2 * margin)
+    int changedRows;        // input rows which differ from the previous frame (left or right)
+    int recomputedRows;     // scanlines which had to be matched again
+    double seconds;         // wall time for the frame
+};
+
+/* Change detection driven recompute for static cameras.
+ * Each output scanline y depends on the input rows y - margin .. y + margin (+ context rows of
+ * preprocessing filters, e.g. 1 for the 3x3 scharr of GradientCost). Only scanlines whose input
+ * band changed are matched again, all others are copied from the previous disparity map.
+ * Cost functions with global preprocessing (CondHistCost) are not covered by the row diff.
+ */
+class IncrementalMatcher
+{
+public:
+    int threshold;      // max. absolute channel difference still treated as unchanged (sensor noise)
+    int context;        // additional input rows each scanline depends on besides blocksize / 2
+
+    IncrementalStats stats;
+
+    IncrementalMatcher(int threshold = 0, int context = 0);
+
+    // bm.functions have to be set up for the current frame (left, right)
+    cv::Mat compute(BlockMatching &bm, cv::Mat left, cv::Mat right, int blocksize);
+    void reset();
+
+private:
+    cv::Mat prevLeft;
+    cv::Mat prevRight;
+    cv::Mat prevDisparity;
+    int prevBlocksize;
+
+    void changedRows(cv::Mat prev, cv::Mat cur, std::vector<bool> &changed);
+};
+
+#endif // INCREMENTAL_H
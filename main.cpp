@@ -3,11 +3,29 @@
 
 #include <vector>
 #include <limits>
-#include <ctime>
+#include <sstream>
+#include <fstream>
 
 #include "filters.h"
 #include "blockmatching.h"
 #include "dpmat.h"
+#include "incremental.h"
+#include "streaming.h"
+#include "dsifile.h"
+#include "sweep.h"
+#include "progressive.h"
+#include "sharding.h"
+#include "daemon.h"
+#include "rectify.h"
+#include "pointcloud.h"
+#include "postfilter.h"
+#include "autorange.h"
+#include "trace.h"
+#include "memstats.h"
+#include "coststats.h"
+#include "output.h"
+#include "taskgraph.h"
+#include "costfactory.h"
 
 using namespace std;
 using namespace cv;
@@ -22,6 +40,174 @@ void print_help() {
     cout << "\t-ti DSI test" << endl;
     cout << "\t-b <Blocksize>" << endl;
     cout << "\t-c color map(jet)" << endl;
+    cout << "\t-o16 write the 16 bit disparities without normalization (-o .png/.pgm, .pfm is always float)" << endl;
+    cout << "\t-png-level <0-9> PNG compression of -o (default 1, fast)" << endl;
+    cout << "\t-seq <leftsequence> <rightsequence> incremental mode for static cameras" << endl;
+    cout << "\t     (video files or image patterns like left_%03d.png, -o takes a pattern too)" << endl;
+    cout << "\t-thr <threshold> max. pixel difference treated as unchanged in -seq mode" << endl;
+    cout << "\t-stream <MB> match in strips with bounded memory (binary PGM/PPM input, 16 bit PGM output)" << endl;
+    cout << "\t-raw <width> <height> <channels> inputs of -stream are raw 8 bit BGR/gray files" << endl;
+    cout << "\t-occ <south> <east> occlusion penalties of the dynamic programming" << endl;
+    cout << "\t-dsi-out <file> save the cost volume (memory mapped raw format)" << endl;
+    cout << "\t-dsi-in <file> load a saved cost volume and only run the dynamic programming" << endl;
+    cout << "\t-dsp <file> save the 16 bit disparity map (memory mapped raw format)" << endl;
+    cout << "\t-sweep-w <w1,w2,..> sweep cost function weights (every function gets every weight)" << endl;
+    cout << "\t-sweep-occ <o1,o2,..> sweep occlusion penalties" << endl;
+    cout << "\t-roi <x> <y> <width> <height> only compute the disparity inside a rectangle" << endl;
+    cout << "\t-pts <file> only compute the disparity at the pixels listed in file (\"x y\" per line)" << endl;
+    cout << "\t-maxd <disparity> disparity limit, bounds the columns -roi/-pts have to match" << endl;
+    cout << "\t--profile print the time spent per stage" << endl;
+    cout << "\t-trace <file.json> write a chrome trace (chrome://tracing, perfetto) of all stages" << endl;
+    cout << "\t-prog <seconds> progressive display: coarse result within the time budget, then refined" << endl;
+    cout << "\t-shards <n> split the scanlines over n worker processes (pinned to NUMA nodes)" << endl;
+    cout << "\t-serve <socket> server mode, requests over a unix domain socket (see daemon.h)" << endl;
+    cout << "\t-client <socket> <request..> send one request to a server, e.g. match l.png r.png /dev/shm/d.dsp b=5" << endl;
+    cout << "\t-calib <file> rectify the inputs (-s, -seq) with a stereo calibration (YAML/XML: M1 D1 M2 D2 R T)" << endl;
+    cout << "\t-rect-cache <file> keep the remap tables of -calib in a file" << endl;
+    cout << "\t-ply <file> write the reprojected 3D points (+ color) as binary PLY" << endl;
+    cout << "\t-xyz <file> write the reprojected 3D points as raw float x y z" << endl;
+    cout << "\t-fb <focal> <baseline> reprojection without -calib (focal length in pixels)" << endl;
+    cout << "\t-speckle <size> <diff> invalidate regions smaller than size pixels (neighbours differ by <= diff)" << endl;
+    cout << "\t-fill mark occluded pixels invalid and fill invalid pixels with the background disparity of the row" << endl;
+    cout << "\t-median <radius> median filter of the disparity map (constant time per pixel)" << endl;
+    cout << "\t-range <min> <max> disparity search range (left minus right column)" << endl;
+    cout << "\t-auto-range estimate the disparity range from a sparse matching pre-pass" << endl;
+    cout << "\t-adaptive <min blocksize> texture adaptive windows between min blocksize (textured) and -b (flat)" << endl;
+    cout << "\t-robust apply the robust penalty p() per pixel pair inside the cost aggregation" << endl;
+    cout << "\t-stats print count, mean, min, max and a histogram of the costs per cost function" << endl;
+    cout << "\t-stats-rows <file.csv> write the min/max costs per scanline and cost function" << endl;
+    cout << "\t-mem print allocations, allocated bytes and peak live bytes per stage" << endl;
+}
+
+// prints/writes the trace, memory and cost statistics when main returns
+class TraceReport {
+public:
+    bool profile;
+    string traceFile;
+    bool memory;
+    bool costs;
+    string costRowsFile;
+
+    TraceReport(bool profile, string traceFile, bool memory, bool costs, string costRowsFile)
+        : profile(profile), traceFile(traceFile), memory(memory), costs(costs), costRowsFile(costRowsFile) {
+        Trace::enabled = profile || !traceFile.empty();
+        CostStats::enabled = costs || !costRowsFile.empty();
+        if(memory) MemStats::enable();
+    }
+
+    ~TraceReport() {
+        if(profile) Trace::printSummary(cout);
+        if(!traceFile.empty()) Trace::writeChrome(traceFile);
+        if(memory) MemStats::printSummary(cout);
+        if(costs) CostStats::printSummary(cout);
+        if(!costRowsFile.empty()) CostStats::writeRows(costRowsFile);
+    }
+};
+
+// comma separated list of numbers
+vector<float> parseList(string list) {
+    vector<float> values;
+    stringstream ss(list);
+    string item;
+
+    while(getline(ss, item, ',')) {
+        if(!item.empty()) values.push_back(atof(item.c_str()));
+    }
+
+    return values;
+}
+
+// Aggregate Blockmatchingfunctions (spec as in costfactory.h, e.g. "rgb,gradient,census")
+static const string costSpec = "rgb";
+
+void addCostFunctions(BlockMatching &bm, Mat left, Mat right) {
+    addCostFunctions(bm, costSpec, left, right);
+}
+
+// disparity post processing, in this order
+void postfilter(Mat &disparity, int speckleSize, int speckleDiff, bool fill, int medianRadius) {
+    TRACE_SCOPE("postfilter");
+
+    if(speckleSize > 0) {
+        int removed = removeSpeckles(disparity, speckleSize, speckleDiff);
+        cout << "speckles: " << removed << " pixels invalidated" << endl;
+    }
+    if(fill) fillOcclusions(disparity);
+    if(medianRadius > 0) medianDisparity(disparity, disparity, medianRadius);
+}
+
+// Progressive mode: show every pass
+void showPreview(const Mat &disparity, int pass, void* user) {
+    const DisparityEncoder* encoder = (const DisparityEncoder*) user;
+
+    imshow("disparity", encoder->visualize(disparity));
+    waitKey(1);
+}
+
+// Incremental mode: only scanlines whose input rows changed get matched again
+int runSequence(string leftSeq, string rightSeq, int blocksize, int threshold, string outfile, const DisparityEncoder &encoder, bool display, Rectifier* rectifier) {
+    VideoCapture capL(leftSeq);
+    VideoCapture capR(rightSeq);
+
+    if(!capL.isOpened() || !capR.isOpened()) {
+        cout << "could not open sequence " << leftSeq << " / " << rightSeq << endl;
+        return 1;
+    }
+
+    IncrementalMatcher inc(threshold);
+    Mat left, right, rawLeft, rawRight;
+
+    while(capL.read(rectifier ? rawLeft : left) && capR.read(rectifier ? rawRight : right)) {
+        if(rectifier && !rectifier->rectify(rawLeft, rawRight, left, right)) return 1;
+        assert(left.size() == right.size() && "image size not equal");
+
+        BlockMatching bm;
+        addCostFunctions(bm, left, right);
+
+        Mat disparity = inc.compute(bm, left, right, blocksize);
+
+        cout << "frame " << inc.stats.frame << ": recomputed " << inc.stats.recomputedRows << "/" << inc.stats.rows
+             << " rows (" << inc.stats.changedRows << " input rows changed), "
+             << inc.stats.seconds << " seconds" << endl;
+
+        Mat out;
+        if(!outfile.empty() && !encoder.write(cv::format(outfile.c_str(), inc.stats.frame), disparity, out)) return 1;
+
+        if(display) {
+            if(out.empty()) out = encoder.visualize(disparity);
+            imshow("disparity", out);
+            if(waitKey(1) == 27) break;
+        }
+    }
+
+    return 0;
+}
+
+// Strip streaming mode: input is read from memory mapped files, disparity written strip by strip
+int runStreaming(string leftFile, string rightFile, int blocksize, size_t memCap, int rawWidth, int rawHeight, int rawChannels, string outfile) {
+    if(outfile.empty()) {
+        cout << "-stream needs an output file (-o disparity.pgm)" << endl;
+        return 1;
+    }
+
+    StripReader left, right;
+    bool ok;
+    if(rawWidth > 0) {
+        ok = left.openRaw(leftFile, rawWidth, rawHeight, rawChannels) &&
+             right.openRaw(rightFile, rawWidth, rawHeight, rawChannels);
+    }
+    else {
+        ok = left.openPNM(leftFile) && right.openPNM(rightFile);
+    }
+    if(!ok) return 1;
+
+    PGM16Writer out;
+    if(!out.open(outfile, left.width, left.height)) return 1;
+
+    StripMatcher matcher(memCap);
+    if(!matcher.compute(left, right, addCostFunctions, blocksize, out)) return 1;
+
+    return out.close() ? 0 : 1;
 }
 
 int main(int argc, char *argv[])
@@ -32,9 +218,43 @@ int main(int argc, char *argv[])
     bool display = false;
     bool dsi = false;
     bool gradient = false;
-    bool cmap = false;
+    DisparityEncoder encoder;
+    bool sequence = false;
     string outfile = "";
     int blocksize = 3;
+    int threshold = 0;
+    size_t memCap = 0;
+    int rawWidth = 0, rawHeight = 0, rawChannels = 3;
+    float occlusionSouth = 1.0f, occlusionEast = 1.0f;
+    string costsOut = "";
+    string costsIn = "";
+    string dspOut = "";
+    vector<float> sweepWeights, sweepOcclusions;
+    Rect roi;
+    string pointsFile = "";
+    int maxDisparity = -1;
+    bool profile = false;
+    string traceFile = "";
+    bool memory = false;
+    bool costStats = false;
+    string costRowsFile = "";
+    bool robust = false;
+    double progressive = -1;
+    int shards = 0;
+    string serveSocket = "";
+    string clientSocket = "";
+    string request = "";
+    string calibFile = "";
+    string rectCache = "";
+    string cloudFile = "";
+    bool rawCloud = false;
+    double focal = 0, baseline = 0;
+    int medianRadius = 0;
+    int speckleSize = 0, speckleDiff = 1;
+    bool fill = false;
+    int rangeMin = 1, rangeMax = 0;     // not set
+    bool autoRange = false;
+    int adaptiveBlocksize = 0;
 
     for(int i = 1; i < argc; ++i) {
         string arg = argv[i];
@@ -67,48 +287,375 @@ int main(int argc, char *argv[])
         }
 
         if(arg == "-c") {
-            cmap = true;
+            encoder.colormap = true;
+        }
+        if(arg == "-o16") {
+            encoder.raw = true;
+        }
+        if(arg == "-png-level" && i + 1 < argc) {
+            // the encoder clamps to 0 - 9
+            encoder.pngCompression = atoi(argv[++i]);
+            if(encoder.pngCompression < 0 || encoder.pngCompression > 9)
+                cout << "-png-level " << encoder.pngCompression << " is out of range, clamped to 0 - 9" << endl;
+        }
+
+        if(arg == "-seq" && i + 2 < argc) {
+            leftFile = argv[++i];
+            rightFile= argv[++i];
+            sequence = true;
+        }
+        if(arg == "-thr" && i + 1 < argc) {
+            threshold = atoi(argv[++i]);
+        }
+
+        if(arg == "-stream" && i + 1 < argc) {
+            memCap = (size_t) atoi(argv[++i]) * 1024 * 1024;
+        }
+        if(arg == "-raw" && i + 3 < argc) {
+            rawWidth = atoi(argv[++i]);
+            rawHeight = atoi(argv[++i]);
+            rawChannels = atoi(argv[++i]);
+        }
+
+        if(arg == "-occ" && i + 2 < argc) {
+            occlusionSouth = atof(argv[++i]);
+            occlusionEast = atof(argv[++i]);
+        }
+        if(arg == "-dsi-out" && i + 1 < argc) {
+            costsOut = argv[++i];
+        }
+        if(arg == "-dsi-in" && i + 1 < argc) {
+            costsIn = argv[++i];
+        }
+        if(arg == "-dsp" && i + 1 < argc) {
+            dspOut = argv[++i];
+        }
+
+        if(arg == "-sweep-w" && i + 1 < argc) {
+            sweepWeights = parseList(argv[++i]);
+        }
+        if(arg == "-sweep-occ" && i + 1 < argc) {
+            sweepOcclusions = parseList(argv[++i]);
+        }
+
+        if(arg == "-roi" && i + 4 < argc) {
+            roi.x = atoi(argv[++i]);
+            roi.y = atoi(argv[++i]);
+            roi.width = atoi(argv[++i]);
+            roi.height = atoi(argv[++i]);
+        }
+        if(arg == "-pts" && i + 1 < argc) {
+            pointsFile = argv[++i];
+        }
+        if(arg == "-maxd" && i + 1 < argc) {
+            maxDisparity = atoi(argv[++i]);
+        }
+
+        if(arg == "--profile") {
+            profile = true;
+        }
+        if(arg == "-trace" && i + 1 < argc) {
+            traceFile = argv[++i];
+        }
+        if(arg == "-mem") {
+            memory = true;
+        }
+        if(arg == "-stats") {
+            costStats = true;
+        }
+        if(arg == "-stats-rows" && i + 1 < argc) {
+            costRowsFile = argv[++i];
+        }
+        if(arg == "-robust") {
+            robust = true;
+        }
+        if(arg == "-prog" && i + 1 < argc) {
+            progressive = atof(argv[++i]);
+        }
+        if(arg == "-shards" && i + 1 < argc) {
+            shards = atoi(argv[++i]);
+        }
+        if(arg == "-calib" && i + 1 < argc) {
+            calibFile = argv[++i];
+        }
+        if(arg == "-rect-cache" && i + 1 < argc) {
+            rectCache = argv[++i];
+        }
+        if((arg == "-ply" || arg == "-xyz") && i + 1 < argc) {
+            cloudFile = argv[++i];
+            rawCloud = (arg == "-xyz");
+        }
+        if(arg == "-fb" && i + 2 < argc) {
+            focal = atof(argv[++i]);
+            baseline = atof(argv[++i]);
+        }
+        if(arg == "-median" && i + 1 < argc) {
+            medianRadius = atoi(argv[++i]);
+        }
+        if(arg == "-speckle" && i + 2 < argc) {
+            speckleSize = atoi(argv[++i]);
+            speckleDiff = atoi(argv[++i]);
+        }
+        if(arg == "-fill") {
+            fill = true;
+        }
+        if(arg == "-range" && i + 2 < argc) {
+            rangeMin = atoi(argv[++i]);
+            rangeMax = atoi(argv[++i]);
+        }
+        if(arg == "-auto-range") {
+            autoRange = true;
+        }
+        if(arg == "-adaptive" && i + 1 < argc) {
+            adaptiveBlocksize = atoi(argv[++i]);
+        }
+        if(arg == "-serve" && i + 1 < argc) {
+            serveSocket = argv[++i];
+        }
+        if(arg == "-client" && i + 1 < argc) {
+            // the remaining arguments are the request
+            clientSocket = argv[++i];
+            while(i + 1 < argc) {
+                if(!request.empty()) request += " ";
+                request += argv[++i];
+            }
         }
     }
 
-    if(files) {
-        Mat left = imread(leftFile);
-        Mat right = imread(rightFile);
-        Mat leftg = imread(leftFile, IMREAD_GRAYSCALE);
-        Mat rightg = imread(rightFile, IMREAD_GRAYSCALE);
-        /*Mat l, r;
-        Mat h1 = condHist(left, 3);
-        Mat h2 = condHist(right, 3);
-        Mat l1 = switchColors(left, h1);
-        Mat r1 = switchColors(right, h2);
-        normalize(l1, l, 0, 255, CV_MINMAX, CV_8UC1);
-        normalize(r1, r, 0, 255, CV_MINMAX, CV_8UC1);*/
+    if(encoder.raw && encoder.colormap && !outfile.empty())
+        cout << "-c does not apply to -o16 output, only to the display" << endl;
 
-        assert(left.size() == right.size() && "image size not equal");
-        /*
-        if(dsi) {
-            vector<int> list;
-            list.push_back(10);
-            list.push_back(50);
-            list.push_back(300);
-            BlockMatching::getSimularityMap(left, right, blocksize, list);
+    TraceReport report(profile, traceFile, memory, costStats, costRowsFile);
+    bool postfiltering = medianRadius > 0 || speckleSize > 0 || fill;
+
+    Rectifier rectifier;
+    rectifier.cachePath = rectCache;
+    if(!calibFile.empty() && !rectifier.load(calibFile)) return 1;
 
-            return 0;
-        }*/
+    if(!clientSocket.empty()) {
+        string reply;
+        if(!sendRequest(clientSocket, request, reply)) return 1;
+
+        cout << reply << endl;
+        return reply.compare(0, 2, "ok") == 0 ? 0 : 1;
+    }
+
+    if(!serveSocket.empty()) {
+        MatchServer server(serveSocket);
+        return server.run() ? 0 : 1;
+    }
 
+    if(files && memCap > 0) {
+        return runStreaming(leftFile, rightFile, blocksize, memCap, rawWidth, rawHeight, rawChannels, outfile);
+    }
+
+    if(sequence) {
+        return runSequence(leftFile, rightFile, blocksize, threshold, outfile, encoder, display, calibFile.empty() ? 0 : &rectifier);
+    }
+
+    if(files || !costsIn.empty()) {
         BlockMatching bm;
+        bm.occlusionSouth = occlusionSouth;
+        bm.occlusionEast = occlusionEast;
+        // occluded pixels are 0 instead of the last match: filled by -fill, skipped by -ply/-xyz
+        bool markOcclusions = fill || !cloudFile.empty();
+        bm.markOcclusions = markOcclusions;
 
-        // Aggregate Blockmatchingfunctions
-        bm.functions.push_back(new RGBCost(left, right, 1));
-        //bm.functions.push_back(new GradientCost(left, right, 1));
-        //bm.functions.push_back(new CensusCost(leftg, rightg, 3, 1));
-        //bm.functions.push_back(new CondHistCost(left, right, 1.0));
+        Mat disparity;
+        int64 start = getTickCount();
+
+        if(!costsIn.empty()) {
+            // cost stage is skipped entirely
+            DSIReader costs;
+            if(!costs.open(costsIn)) return 1;
+
+            start = getTickCount();
+            disparity = bm.computeFromCosts(costs);
+        }
+        else {
+            Mat left, right;
+            {
+                TRACE_SCOPE("load");
 
-        clock_t start = clock();
-        Mat disparity = bm.compute(left.size(), blocksize);
+                // both images decoded concurrently
+                TaskGraph graph;
+                graph.add("task/imread", [&]() { left = imread(leftFile); });
+                graph.add("task/imread", [&]() { right = imread(rightFile); });
+                graph.run();
+            }
 
-        // benchmarking
-        double time = ((clock() - start) / (double) CLOCKS_PER_SEC);
+            if(!calibFile.empty()) {
+                Mat rawLeft = left, rawRight = right;
+                left.release();         // remap can not work in place
+                right.release();
+                if(!rectifier.rectify(rawLeft, rawRight, left, right)) return 1;
+            }
+            /*Mat l, r;
+            Mat h1 = condHist(left, 3);
+            Mat h2 = condHist(right, 3);
+            Mat l1 = switchColors(left, h1);
+            Mat r1 = switchColors(right, h2);
+            normalize(l1, l, 0, 255, CV_MINMAX, CV_8UC1);
+            normalize(r1, r, 0, 255, CV_MINMAX, CV_8UC1);*/
+
+            assert(left.size() == right.size() && "image size not equal");
+            /*
+            if(dsi) {
+                vector<int> list;
+                list.push_back(10);
+                list.push_back(50);
+                list.push_back(300);
+                BlockMatching::getSimularityMap(left, right, blocksize, list);
+
+                return 0;
+            }*/
+
+            // -shards: every worker sets up the cost functions of its own band
+            bool sharded = shards > 0 && progressive < 0 && sweepWeights.empty() && sweepOcclusions.empty()
+                && pointsFile.empty() && roi.area() == 0;
+            if(sharded && (autoRange || adaptiveBlocksize > 0 || !costsOut.empty())) {
+                cout << "-auto-range, -adaptive and -dsi-out are not supported with -shards" << endl;
+                return 1;
+            }
+
+            if(!sharded) {
+                // row local functions prepare their rows in the background, compute() starts right away
+                addCostFunctions(bm, costSpec, left, right, blocksize);
+                for(size_t i = 0; robust && i < bm.functions.size(); ++i)
+                    bm.functions[i]->setRobust(true);
+            }
+
+            if(adaptiveBlocksize > 0) {
+                Mat margins = adaptiveMargins(left, min(adaptiveBlocksize, blocksize) / 2, blocksize / 2);
+                for(size_t i = 0; i < bm.functions.size(); ++i)
+                    bm.functions[i]->setSupport(margins);
+
+                double mean = cv::mean(margins)[0];
+                cout << "adaptive windows: mean block size " << 2 * mean + 1 << endl;
+            }
+
+            if(rangeMin <= rangeMax) bm.setDisparityRange(rangeMin, rangeMax);
+            if(autoRange) {
+                RangeEstimator estimator;
+                DisparityRangeEstimate r = estimator.estimate(bm, left, blocksize);
+
+                cout << "auto range: " << r.accepted << "/" << r.samples << " samples, " << r.seconds << " seconds, ";
+                if(r.valid) {
+                    cout << "disparities " << r.minDisparity << " - " << r.maxDisparity << endl;
+                    bm.setDisparityRange(r.minDisparity, r.maxDisparity);
+                }
+                else {
+                    cout << "too few reliable samples, full range" << endl;
+                }
+            }
+
+            if(!sweepWeights.empty() || !sweepOcclusions.empty()) {
+                if(sweepWeights.empty()) sweepWeights.push_back(1.0f);
+                if(sweepOcclusions.empty()) sweepOcclusions.push_back(occlusionSouth);
+
+                ParameterSweep sweep;
+                sweep.grid(bm.functions.size(), sweepWeights, sweepOcclusions);
+
+                vector<SweepResult> results = sweep.run(bm, left.size(), blocksize);
+                sweep.printTable(results, cout);
+
+                return 0;
+            }
+
+            // sparse queries, only the scanlines involved are matched
+            if(!pointsFile.empty()) {
+                ifstream in(pointsFile.c_str());
+                vector<Point> points;
+                int x, y;
+                while(in >> x >> y) points.push_back(Point(x, y));
+
+                int64 t = getTickCount();
+                vector<ushort> values = bm.computePoints(left.size(), blocksize, points, maxDisparity);
+                cout << "Time taken: " << (getTickCount() - t) / getTickFrequency() << " seconds" << endl;
+
+                for(size_t k = 0; k < points.size(); ++k)
+                    cout << points[k].x << " " << points[k].y << " " << values[k] << endl;
+
+                return 0;
+            }
+            if(roi.area() > 0) {
+                int64 t = getTickCount();
+                disparity = bm.computeROI(left.size(), blocksize, roi, maxDisparity);
+                cout << "Time taken: " << (getTickCount() - t) / getTickFrequency() << " seconds" << endl;
+
+                Mat out;
+                if(!outfile.empty() && !encoder.write(outfile, disparity, out)) return 1;
+                if(!dspOut.empty()) writeDisparity(dspOut, disparity);
+
+                if(display || outfile.empty()) {
+                    if(out.empty()) out = encoder.visualize(disparity);
+                    imshow("disparity", out);
+                    waitKey(0);
+                }
+
+                return 0;
+            }
+
+            DSIWriter costs;
+            if(!costsOut.empty()) {
+                if(!costs.open(costsOut, left.size(), blocksize, bm.minDisparity, bm.maxDisparity)) return 1;
+                bm.dsiOut = &costs;
+            }
+
+            PointCloudWriter cloud;
+            if(!cloudFile.empty()) {
+                if(!calibFile.empty()) cloud.Q = rectifier.Q;
+                else if(focal > 0 && baseline > 0) cloud.setFocalBaseline(focal, baseline, Point2d(left.cols / 2.0, left.rows / 2.0));
+                else {
+                    cout << "-ply/-xyz need -calib or -fb <focal> <baseline>" << endl;
+                    return 1;
+                }
+
+                cloud.color = left;
+                if(!cloud.open(cloudFile, rawCloud ? PointCloudWriter::RAW : PointCloudWriter::PLY)) return 1;
+                // streamed by compute() row by row, -prog/-shards do not go through it
+                if(!postfiltering && progressive < 0 && !sharded) bm.cloudOut = &cloud;
+            }
+
+            start = getTickCount();
+            if(progressive >= 0) {
+                ProgressiveMatcher prog(progressive);
+                disparity = prog.compute(bm, left, right, addCostFunctions, blocksize, showPreview, &encoder);
+
+                for(size_t p = 0; p < prog.passes.size(); ++p)
+                    cout << "pass " << p << ": scale " << prog.passes[p].scale << ", rows every " << prog.passes[p].rowStep
+                         << ", " << prog.passes[p].seconds << " seconds" << endl;
+            }
+            else if(sharded) {
+                ShardCoordinator coordinator(shards);
+                coordinator.markOcclusions = markOcclusions;
+                coordinator.minDisparity = bm.minDisparity;
+                coordinator.maxDisparity = bm.maxDisparity;
+                coordinator.robust = robust;
+                if(!coordinator.compute(left, right, addCostFunctions, blocksize, occlusionSouth, occlusionEast, disparity)) return 1;
+
+                for(size_t s = 0; s < coordinator.stats.size(); ++s)
+                    cout << "shard " << s << ": rows " << coordinator.stats[s].y0 << " - " << coordinator.stats[s].y1
+                         << ", node " << coordinator.stats[s].node << ", " << coordinator.stats[s].seconds << " seconds" << endl;
+            }
+            else {
+                disparity = bm.compute(left.size(), blocksize);
+            }
+
+            if(postfiltering) postfilter(disparity, speckleSize, speckleDiff, fill, medianRadius);
+
+            // progressive/sharded/filtered results are reprojected at once
+            if(cloud.isOpen() && !bm.cloudOut) cloud.write(disparity, 0, disparity.rows);
+            if(cloud.isOpen()) cout << cloud.points << " points written to " << cloudFile << endl;
+
+            bm.dsiOut = 0;
+            bm.cloudOut = 0;
+            costs.close();
+            if(!cloud.close()) return 1;
+        }
+
+        // benchmarking (wall time)
+        double time = (getTickCount() - start) / getTickFrequency();
         if(time > 60) {
             cout << "Time taken: " <<  time / 60 << " minutes" << endl;
         }
@@ -116,25 +663,21 @@ int main(int argc, char *argv[])
             cout << "Time taken: " <<  time << " seconds" << endl;
         }
 
-        // Normalize results to display as image
-        Mat out, out2;
-        cv::normalize(disparity, out, 0, 255, NORM_MINMAX, CV_8UC1);
-
-        if(cmap) {
-            applyColorMap(out, out2, COLORMAP_JET);
-        }
-        else {
-            out2 = out;
+        if(!dspOut.empty()) {
+            writeDisparity(dspOut, disparity);
         }
 
+        Mat out2;
+
         if(!outfile.empty()) {
-            imwrite(outfile, out2);
+            if(!encoder.write(outfile, disparity, out2)) return 1;
         }
         else {
             display = true;
         }
 
         if(display){
+            if(out2.empty()) out2 = encoder.visualize(disparity);
             namedWindow("disparity");
             imshow("disparity", out2);
             waitKey(0);
@@ -0,0 +1,128 @@
+#include "mappedfile.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <iostream>
+
+using namespace std;
+
+MappedFile::MappedFile() {
+    data = 0;
+    size = 0;
+    fd = -1;
+    writable = false;
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const string &path) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        cout << "could not open " << path << endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size == 0) {
+        cout << "could not stat " << path << endl;
+        close();
+        return false;
+    }
+
+    void* ptr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        cout << "could not map " << path << endl;
+        close();
+        return false;
+    }
+
+    data = (unsigned char*) ptr;
+    size = st.st_size;
+    writable = false;
+
+    return true;
+}
+
+bool MappedFile::create(const string &path, size_t size) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    if(ftruncate(fd, size) != 0) {
+        cout << "could not resize " << path << " to " << size << " bytes" << endl;
+        close();
+        return false;
+    }
+
+    void* ptr = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(ptr == MAP_FAILED) {
+        cout << "could not map " << path << endl;
+        close();
+        return false;
+    }
+
+    data = (unsigned char*) ptr;
+    this->size = size;
+    writable = true;
+
+    return true;
+}
+
+void MappedFile::close() {
+    if(data) {
+        if(writable) msync(data, size, MS_SYNC);
+        munmap(data, size);
+    }
+    if(fd >= 0) ::close(fd);
+
+    data = 0;
+    size = 0;
+    fd = -1;
+    writable = false;
+}
+
+// madvise needs page aligned addresses, so shrink the range to the whole pages inside of it
+static void pageRange(unsigned char* data, size_t size, size_t offset, size_t length, unsigned char* &start, size_t &len) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t first = ((offset + page - 1) / page) * page;
+    size_t last = min(offset + length, size);
+
+    if(last < size) last = (last / page) * page;     // keep the partial page shared with the following data
+
+    start = data + first;
+    len = last > first ? last - first : 0;
+}
+
+void MappedFile::prefetch(size_t offset, size_t length) {
+    if(!data) return;
+
+    unsigned char* start; size_t len;
+    pageRange(data, size, offset, length, start, len);
+    if(len > 0) madvise(start, len, MADV_WILLNEED);
+}
+
+void MappedFile::release(size_t offset, size_t length) {
+    if(!data) return;
+
+    unsigned char* start; size_t len;
+    pageRange(data, size, offset, length, start, len);
+    if(len == 0) return;
+
+    if(writable) msync(start, len, MS_SYNC);    // write back before dropping dirty pages
+    madvise(start, len, MADV_DONTNEED);
+}
+
+void MappedFile::flush() {
+    if(data && writable) msync(data, size, MS_SYNC);
+}
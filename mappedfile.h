@@ -0,0 +1,35 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+#include <cstddef>
+
+// RAII wrapper around a (posix) memory mapped file
+class MappedFile
+{
+public:
+    unsigned char* data;
+    size_t size;
+
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const std::string &path);                     // map existing file read only
+    bool create(const std::string &path, size_t size);      // create/truncate file to size, map read/write
+    void close();
+
+    bool isOpen() const { return data != 0; }
+
+    void prefetch(size_t offset, size_t length);            // pages will be needed soon
+    void release(size_t offset, size_t length);             // pages are no longer needed (keeps rss bounded)
+    void flush();
+
+private:
+    int fd;
+    bool writable;
+
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+};
+
+#endif // MAPPEDFILE_H
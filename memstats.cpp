@@ -0,0 +1,143 @@
+#include "memstats.h"
+#include "trace.h"
+
+#include <map>
+#include <string>
+#include <mutex>
+#include <iomanip>
+
+using namespace std;
+using namespace cv;
+
+#if CV_VERSION_MAJOR >= 4
+typedef AccessFlag AllocFlags;
+#else
+typedef int AllocFlags;
+#endif
+
+struct StageStats {
+    long allocations;
+    long frees;
+    size_t allocated;       // bytes
+    long long live;
+    long long peak;
+};
+
+bool MemStats::enabled = false;
+
+static mutex statsMutex;
+static map<string, StageStats> stages;
+static long long totalLive = 0;
+static long long totalPeak = 0;
+
+static const char* STAGE_OTHER = "other";
+
+static void countAlloc(const char* stage, size_t bytes) {
+    lock_guard<mutex> lock(statsMutex);
+
+    StageStats &s = stages[stage];
+    s.allocations++;
+    s.allocated += bytes;
+    s.live += bytes;
+    s.peak = max(s.peak, s.live);
+
+    totalLive += bytes;
+    totalPeak = max(totalPeak, totalLive);
+}
+
+static void countFree(const char* stage, size_t bytes) {
+    lock_guard<mutex> lock(statsMutex);
+
+    StageStats &s = stages[stage];
+    s.frees++;
+    s.live -= bytes;
+
+    totalLive -= bytes;
+}
+
+static const char* currentStage() {
+    return Trace::stage ? Trace::stage : STAGE_OTHER;
+}
+
+/* Wraps the standard allocator. UMatData::userdata keeps the stage of the allocation,
+ * currAllocator points to this allocator, so the release of the buffer comes back here.
+ */
+class CountingAllocator : public MatAllocator {
+public:
+    MatAllocator* stdAllocator;
+
+    CountingAllocator() : stdAllocator(Mat::getStdAllocator()) {}
+
+    UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step, AllocFlags flags, UMatUsageFlags usageFlags) const {
+        UMatData* u = stdAllocator->allocate(dims, sizes, type, data, step, flags, usageFlags);
+        if(!u) return u;
+
+        u->currAllocator = this;
+        u->userdata = (void*) currentStage();
+
+        // user provided data (Mat headers over foreign memory) is not ours
+        if(!data) countAlloc((const char*) u->userdata, u->size);
+
+        return u;
+    }
+
+    bool allocate(UMatData* u, AllocFlags accessFlags, UMatUsageFlags usageFlags) const {
+        return stdAllocator->allocate(u, accessFlags, usageFlags);
+    }
+
+    void deallocate(UMatData* u) const {
+        if(!u) return;
+
+        if(!(u->flags & UMatData::USER_ALLOCATED)) countFree((const char*) u->userdata, u->size);
+
+        u->currAllocator = stdAllocator;
+        stdAllocator->deallocate(u);
+    }
+};
+
+void MemStats::enable() {
+    static CountingAllocator allocator;
+
+    if(enabled) return;
+
+    Mat::setDefaultAllocator(&allocator);
+    enabled = true;
+}
+
+const char* MemStats::add(size_t bytes) {
+    if(!enabled) return 0;
+
+    const char* stage = currentStage();
+    countAlloc(stage, bytes);
+    return stage;
+}
+
+// buffers allocated before enable() were not counted (stage 0)
+void MemStats::remove(const char* stage, size_t bytes) {
+    if(enabled && stage) countFree(stage, bytes);
+}
+
+size_t MemStats::peakBytes() {
+    lock_guard<mutex> lock(statsMutex);
+    return (size_t) totalPeak;
+}
+
+void MemStats::printSummary(ostream &out) {
+    lock_guard<mutex> lock(statsMutex);
+
+    const double MB = 1024.0 * 1024.0;
+
+    out << left << setw(28) << "stage" << right << setw(12) << "allocs" << setw(14) << "allocated MB"
+        << setw(12) << "peak MB" << setw(12) << "live MB" << endl;
+
+    for(map<string, StageStats>::iterator it = stages.begin(); it != stages.end(); ++it) {
+        const StageStats &s = it->second;
+
+        out << left << setw(28) << it->first << right << fixed << setprecision(2)
+            << setw(12) << s.allocations << setw(14) << s.allocated / MB
+            << setw(12) << s.peak / MB << setw(12) << s.live / MB << endl;
+    }
+
+    out << left << setw(28) << "total peak live" << right << setw(38) << totalPeak / MB << " MB" << endl;
+    out.unsetf(ios::fixed);
+}
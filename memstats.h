@@ -0,0 +1,28 @@
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#include <opencv2/opencv.hpp>
+#include <ostream>
+#include <cstddef>
+
+/* Memory accounting per pipeline stage.
+ * enable() installs a counting cv::MatAllocator as default allocator, so every cv::Mat created
+ * afterwards is counted; own buffers report through add()/remove(). Allocations are attributed to
+ * the current stage of the allocating thread, the innermost TRACE_SCOPE ("other" outside of any),
+ * also with the timing compiled out. Frees are charged to the stage of the allocation: the
+ * allocator keeps it in UMatData::userdata, own buffers keep the stage add() returned.
+ */
+class MemStats
+{
+public:
+    static bool enabled;
+
+    static void enable();
+    static const char* add(size_t bytes);               // own buffers, returns the stage (0 if disabled)
+    static void remove(const char* stage, size_t bytes);    // stage returned by add()
+
+    static size_t peakBytes();              // all stages
+    static void printSummary(std::ostream &out);
+};
+
+#endif // MEMSTATS_H
@@ -0,0 +1,116 @@
+#include "mutualinfo.h"
+#include "blockmatching.h"
+
+using namespace std;
+using namespace cv;
+
+// -log of a smoothed distribution, smoothed again
+static Mat entropyTerm(Mat p, Size kernel) {
+    Mat s, h;
+    GaussianBlur(p, s, kernel, 0);
+
+    h.create(s.size(), CV_32F);
+    for(int i = 0; i < s.rows; ++i) {
+        const float* src = s.ptr<float>(i);
+        float* dst = h.ptr<float>(i);
+        for(int j = 0; j < s.cols; ++j)
+            dst[j] = -std::log(std::max(src[j], 1e-7f));
+    }
+
+    GaussianBlur(h, h, kernel, 0);
+    return h;
+}
+
+Mat miTable(Mat left, Mat right, Mat disparity, int margin) {
+    assert(left.type() == CV_8UC1 && right.type() == CV_8UC1 && disparity.type() == CV_16U);
+
+    Mat joint = Mat::zeros(256, 256, CV_32F);
+    long n = 0;
+
+    for(int y = margin; y < left.rows - margin; ++y) {
+        const uchar* l = left.ptr<uchar>(y);
+        const uchar* r = right.ptr<uchar>(y);
+        const ushort* d = disparity.ptr<ushort>(y);
+
+        for(int x = margin; x < left.cols - margin; ++x) {
+            int x2 = x - d[x];
+            if(x2 < margin) continue;
+
+            joint.at<float>(l[x], r[x2]) += 1;
+            n++;
+        }
+    }
+
+    if(n < 256) return Mat();
+    joint.convertTo(joint, CV_32F, 1.0 / n);
+
+    // marginals
+    Mat pl = Mat::zeros(256, 1, CV_32F);
+    Mat pr = Mat::zeros(1, 256, CV_32F);
+    for(int i = 0; i < 256; ++i) {
+        const float* row = joint.ptr<float>(i);
+        for(int k = 0; k < 256; ++k) {
+            pl.at<float>(i, 0) += row[k];
+            pr.at<float>(0, k) += row[k];
+        }
+    }
+
+    Mat hlr = entropyTerm(joint, Size(7, 7));
+    Mat hl = entropyTerm(pl, Size(1, 7));
+    Mat hr = entropyTerm(pr, Size(7, 1));
+
+    // cost = -mi = hlr - hl - hr
+    Mat table(256, 256, CV_32F);
+    for(int i = 0; i < 256; ++i) {
+        const float* h = hlr.ptr<float>(i);
+        float* t = table.ptr<float>(i);
+        for(int k = 0; k < 256; ++k)
+            t[k] = h[k] - hl.at<float>(i, 0) - hr.at<float>(0, k);
+    }
+
+    normalize(table, table, 0, 1, NORM_MINMAX);
+    return table;
+}
+
+Mat mutualInformationTable(Mat left, Mat right, int levels) {
+    TRACE_SCOPE("preprocess/mutualInformationTable");
+
+    const int blocksize = 3;
+    Mat table;
+
+    for(int level = levels; level >= 2; --level) {
+        int scale = 1 << level;
+        Size small(left.cols / scale, left.rows / scale);
+        if(small.width <= 4 * blocksize || small.height <= 4 * blocksize) continue;
+
+        Mat l, r;
+        resize(left, l, small, 0, 0, INTER_AREA);
+        resize(right, r, small, 0, 0, INTER_AREA);
+
+        BlockMatching bm;
+        if(table.empty()) bm.functions.push_back(new GrayCost(l, r, 1));
+        else bm.functions.push_back(new MICost(l, r, table, 1));
+
+        vector<int> lines;
+        for(int y = blocksize / 2; y < small.height - blocksize / 2; ++y)
+            lines.push_back(y);
+
+        Mat d = Mat::zeros(small, CV_16U);
+        bm.prepare(blocksize);
+        bm.computeLines(small, blocksize, lines, d);
+
+        Mat t = miTable(l, r, d, blocksize / 2);
+        if(!t.empty()) table = t;
+    }
+
+    // absolute differences
+    if(table.empty()) {
+        table.create(256, 256, CV_32F);
+        for(int i = 0; i < 256; ++i) {
+            for(int k = 0; k < 256; ++k)
+                table.at<float>(i, k) = std::abs(i - k) / 255.0f;
+        }
+    }
+
+    return table;
+}
@@ -0,0 +1,19 @@
+#ifndef MUTUALINFO_H
+#define MUTUALINFO_H
+
+#include <opencv2/opencv.hpp>
+
+/* Mutual information cost table (hierarchical MI as in semi global matching).
+ * 256 x 256 CV_32F, [left intensity][right intensity], -MI normalized to [0, 1].
+ *
+ * miTable: joint histogram of the pairs (left(x, y), right(x - d, y)) given a disparity map
+ *   (d = x1 - x2), gaussian smoothing of the joint and marginal distributions and their entropy
+ *   terms. Empty if there are too few pairs.
+ * mutualInformationTable: hierarchical estimate, the pair is matched at scales 2^levels .. 4,
+ *   first with absolute differences, then with the table of the previous scale.
+ *   Falls back to absolute differences for images too small to scale down.
+ */
+cv::Mat miTable(cv::Mat left, cv::Mat right, cv::Mat disparity, int margin);
+cv::Mat mutualInformationTable(cv::Mat left, cv::Mat right, int levels);
+
+#endif // MUTUALINFO_H
@@ -0,0 +1,264 @@
+#include "output.h"
+#include "trace.h"
+
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+DisparityEncoder::DisparityEncoder(bool colormap) : colormap(colormap) {
+    raw = false;
+    pngCompression = 1;
+}
+
+// jet colors of the gray values 0 - 255
+static Mat buildPalette() {
+    Mat ramp(1, 256, CV_8UC1), palette;
+    for(int i = 0; i < 256; ++i) ramp.at<uchar>(0, i) = (uchar) i;
+
+    applyColorMap(ramp, palette, COLORMAP_JET);
+    return palette;
+}
+
+static const Mat &jetPalette() {
+    static const Mat palette = buildPalette();
+    return palette;
+}
+
+// min/max per strip of rows, merged by the caller
+class MinMaxBody : public ParallelLoopBody {
+public:
+    const Mat &disparity;
+    vector<ushort> &mins;
+    vector<ushort> &maxs;
+    int rowsPerStrip;
+
+    MinMaxBody(const Mat &disparity, vector<ushort> &mins, vector<ushort> &maxs, int rowsPerStrip)
+        : disparity(disparity), mins(mins), maxs(maxs), rowsPerStrip(rowsPerStrip) {}
+
+    void operator()(const Range &range) const {
+        for(int s = range.start; s < range.end; ++s) {
+            ushort lo = 65535, hi = 0;
+
+            for(int y = s * rowsPerStrip; y < min((s + 1) * rowsPerStrip, disparity.rows); ++y) {
+                const ushort* ptr = disparity.ptr<ushort>(y);
+                for(int x = 0; x < disparity.cols; ++x) {
+                    lo = std::min(lo, ptr[x]);
+                    hi = std::max(hi, ptr[x]);
+                }
+            }
+
+            mins[s] = lo;
+            maxs[s] = hi;
+        }
+    }
+};
+
+// out(y, x) = lut[disparity(y, x) - offset], lut entries have out.channels() bytes
+class LUTBody : public ParallelLoopBody {
+public:
+    const Mat &disparity;
+    Mat &out;
+    const uchar* lut;
+    int offset;
+
+    LUTBody(const Mat &disparity, Mat &out, const uchar* lut, int offset) : disparity(disparity), out(out), lut(lut), offset(offset) {}
+
+    void operator()(const Range &range) const {
+        int cn = out.channels();
+
+        for(int y = range.start; y < range.end; ++y) {
+            const ushort* src = disparity.ptr<ushort>(y);
+            uchar* dst = out.ptr<uchar>(y);
+
+            if(cn == 1) {
+                for(int x = 0; x < disparity.cols; ++x)
+                    dst[x] = lut[src[x] - offset];
+            }
+            else {
+                for(int x = 0; x < disparity.cols; ++x) {
+                    const uchar* c = lut + 3 * (src[x] - offset);
+                    dst[3*x] = c[0];
+                    dst[3*x + 1] = c[1];
+                    dst[3*x + 2] = c[2];
+                }
+            }
+        }
+    }
+};
+
+Mat DisparityEncoder::visualize(const Mat &disparity) const {
+    TRACE_SCOPE("output/visualize");
+    assert(disparity.type() == CV_16U);
+
+    Mat out(disparity.size(), colormap ? CV_8UC3 : CV_8UC1);
+    if(disparity.empty()) return out;
+
+    int strips = max(1, min(disparity.rows, getNumThreads() * 4));
+    int rowsPerStrip = (disparity.rows + strips - 1) / strips;
+    strips = (disparity.rows + rowsPerStrip - 1) / rowsPerStrip;
+
+    vector<ushort> mins(strips), maxs(strips);
+    parallel_for_(Range(0, strips), MinMaxBody(disparity, mins, maxs, rowsPerStrip), strips);
+
+    int lo = *min_element(mins.begin(), mins.end());
+    int hi = *max_element(maxs.begin(), maxs.end());
+
+    // only the values in [lo, hi] get an entry, rounded like cv::normalize
+    double scale = hi > lo ? 255.0 / (hi - lo) : 0;
+    const Mat &palette = jetPalette();
+    int cn = out.channels();
+
+    vector<uchar> lut((hi - lo + 1) * cn);
+    for(int v = lo; v <= hi; ++v) {
+        uchar g = saturate_cast<uchar>(cvRound((v - lo) * scale));
+
+        if(cn == 1) lut[v - lo] = g;
+        else memcpy(&lut[(v - lo) * 3], palette.ptr<uchar>(0) + 3 * g, 3);
+    }
+
+    parallel_for_(Range(0, disparity.rows), LUTBody(disparity, out, &lut[0], lo));
+
+    return out;
+}
+
+// rows of a PNM/PFM body into one buffer: big endian 16 bit, RGB order, float rows bottom up
+class PackBody : public ParallelLoopBody {
+public:
+    const Mat &image;
+    uchar* buffer;
+    size_t rowBytes;
+    bool pfm;
+
+    PackBody(const Mat &image, uchar* buffer, size_t rowBytes, bool pfm) : image(image), buffer(buffer), rowBytes(rowBytes), pfm(pfm) {}
+
+    void operator()(const Range &range) const {
+        for(int y = range.start; y < range.end; ++y) {
+            if(pfm) {
+                const ushort* src = image.ptr<ushort>(y);
+                float* dst = (float*) (buffer + (image.rows - 1 - y) * rowBytes);
+                for(int x = 0; x < image.cols; ++x) dst[x] = src[x];
+            }
+            else if(image.depth() == CV_16U) {
+                const ushort* src = image.ptr<ushort>(y);
+                uchar* dst = buffer + y * rowBytes;
+                for(int x = 0; x < image.cols; ++x) {
+                    dst[2*x] = (uchar) (src[x] >> 8);
+                    dst[2*x + 1] = (uchar) (src[x] & 0xFF);
+                }
+            }
+            else if(image.channels() == 3) {
+                const uchar* src = image.ptr<uchar>(y);
+                uchar* dst = buffer + y * rowBytes;
+                for(int x = 0; x < image.cols; ++x) {
+                    dst[3*x] = src[3*x + 2];
+                    dst[3*x + 1] = src[3*x + 1];
+                    dst[3*x + 2] = src[3*x];
+                }
+            }
+            else {
+                memcpy(buffer + y * rowBytes, image.ptr<uchar>(y), rowBytes);
+            }
+        }
+    }
+};
+
+static bool writeBuffer(const string &path, const string &header, const Mat &image, size_t rowBytes, bool pfm) {
+    vector<uchar> buffer(rowBytes * image.rows);
+    if(!buffer.empty()) parallel_for_(Range(0, image.rows), PackBody(image, &buffer[0], rowBytes, pfm));
+
+    FILE* f = fopen(path.c_str(), "wb");
+    if(!f) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    bool ok = fwrite(header.data(), 1, header.size(), f) == header.size();
+    ok = ok && fwrite(buffer.data(), 1, buffer.size(), f) == buffer.size();
+    ok = (fclose(f) == 0) && ok;
+
+    if(!ok) cout << "could not write " << path << endl;
+    return ok;
+}
+
+bool DisparityEncoder::writePNM(const string &path, const Mat &image) {
+    TRACE_SCOPE("output/pnm");
+    assert(image.type() == CV_8UC1 || image.type() == CV_8UC3 || image.type() == CV_16UC1);
+
+    bool color = image.channels() == 3;
+    int maxval = image.depth() == CV_16U ? 65535 : 255;
+    string header = format("%s\n%d %d\n%d\n", color ? "P6" : "P5", image.cols, image.rows, maxval);
+
+    return writeBuffer(path, header, image, image.cols * image.elemSize(), false);
+}
+
+// little endian (negative scale), rows bottom to top
+bool DisparityEncoder::writePFM(const string &path, const Mat &disparity) {
+    TRACE_SCOPE("output/pfm");
+    assert(disparity.type() == CV_16U);
+
+    string header = format("Pf\n%d %d\n-1.0\n", disparity.cols, disparity.rows);
+    return writeBuffer(path, header, disparity, disparity.cols * sizeof(float), true);
+}
+
+static string extension(const string &path) {
+    size_t dot = path.rfind('.');
+    if(dot == string::npos) return "";
+
+    string ext = path.substr(dot + 1);
+    for(size_t i = 0; i < ext.size(); ++i) ext[i] = (char) tolower(ext[i]);
+    return ext;
+}
+
+bool DisparityEncoder::write(const string &path, const Mat &disparity, Mat &visual) const {
+    string ext = extension(path);
+    if(ext == "pfm") return writePFM(path, disparity);
+
+    Mat image = disparity;
+    if(!raw) {
+        visual = visualize(disparity);
+        image = visual;
+    }
+
+    if(ext == "pgm" || ext == "ppm") {
+        if(ext == "pgm" && image.channels() == 3) {
+            cout << "PGM output needs a gray image (no colormap)" << endl;
+            return false;
+        }
+        if(ext == "ppm" && raw) {
+            cout << "PPM output has 8 bit colors, write 16 bit disparities (-o16) to .pgm or .png" << endl;
+            return false;
+        }
+
+        // gray values as P6, the extension promises a color image
+        if(ext == "ppm" && image.channels() == 1) {
+            Mat color;
+            cvtColor(image, color, COLOR_GRAY2BGR);
+            return writePNM(path, color);
+        }
+        return writePNM(path, image);
+    }
+
+    TRACE_SCOPE("output/imwrite");
+
+    vector<int> params;
+    if(ext == "png") {
+        params.push_back(IMWRITE_PNG_COMPRESSION);
+        params.push_back(std::max(0, std::min(9, pngCompression)));
+    }
+
+    if(!imwrite(path, image, params)) {
+        cout << "could not write " << path << endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool DisparityEncoder::write(const string &path, const Mat &disparity) const {
+    Mat visual;
+    return write(path, disparity, visual);
+}
@@ -0,0 +1,35 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+
+/* Output stage for 16 bit disparity maps.
+ * visualize(): min/max normalization to 8 bit (as cv::normalize NORM_MINMAX) and the optional
+ * jet colormap in a single pass over a 16 bit -> gray/BGR lookup table, rows in parallel.
+ * write(): encoder by extension, rows are converted in parallel and written with one call.
+ *   .pgm/.ppm  binary PNM (gray PGM, color PPM), raw: 16 bit PGM (maxval 65535), no PPM
+ *   .pfm       disparity values as float (normalization and colormap do not apply)
+ *   .png       pngCompression (clamped to 0 - 9, low is fast), raw: 16 bit PNG
+ *   other      cv::imwrite defaults
+ */
+class DisparityEncoder
+{
+public:
+    bool colormap;          // jet instead of gray
+    bool raw;               // write the disparity values without normalization
+    int pngCompression;
+
+    DisparityEncoder(bool colormap = false);
+
+    cv::Mat visualize(const cv::Mat &disparity) const;
+
+    // visual: normalized image if one was encoded (can be reused for display)
+    bool write(const std::string &path, const cv::Mat &disparity, cv::Mat &visual) const;
+    bool write(const std::string &path, const cv::Mat &disparity) const;
+
+    static bool writePNM(const std::string &path, const cv::Mat &image);     // CV_8UC1, CV_8UC3, CV_16UC1
+    static bool writePFM(const std::string &path, const cv::Mat &disparity);
+};
+
+#endif // OUTPUT_H
@@ -0,0 +1,89 @@
+#include "paddedimage.h"
+#include "trace.h"
+
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+static size_t roundUp(size_t bytes, size_t align) {
+    return (bytes + align - 1) / align * align;
+}
+
+// rows [y0, y1) (-pad .. rows + pad) of one channel of src into a padded plane, borders replicated
+template<typename T>
+static void fillPlane(const Mat &src, int c, uchar* origin, size_t step, int pad, int y0, int y1) {
+    int cn = src.channels();
+
+    for(int y = y0; y < y1; ++y) {
+        const T* s = src.ptr<T>(min(max(y, 0), src.rows - 1));
+        T* d = (T*) (origin + (ptrdiff_t) y * (ptrdiff_t) step);
+
+        for(int x = 0; x < src.cols; ++x)
+            d[x] = s[x * cn + c];
+
+        T first = d[0], last = d[src.cols - 1];
+        for(int x = 1; x <= pad; ++x) {
+            d[-x] = first;
+            d[src.cols - 1 + x] = last;
+        }
+    }
+}
+
+PaddedImage::PaddedImage() {
+    rows = cols = channels = pad = 0;
+    depth = CV_8U;
+    step = planeStep = 0;
+    origin = 0;
+}
+
+PaddedImage::PaddedImage(const Mat &image, int pad) {
+    origin = 0;
+    create(image, pad);
+}
+
+void PaddedImage::create(const Mat &image, int pad) {
+    TRACE_SCOPE("preprocess/PaddedImage");
+
+    allocate(image, pad);
+    fill(0, rows);
+}
+
+void PaddedImage::allocate(const Mat &image, int pad) {
+    assert((image.depth() == CV_8U || image.depth() == CV_32F) && !image.empty() && pad >= 0);
+
+    source = image;
+    rows = image.rows;
+    cols = image.cols;
+    channels = image.channels();
+    depth = image.depth();
+    this->pad = pad;
+
+    size_t elem = (depth == CV_8U) ? 1 : sizeof(float);
+    size_t lead = roundUp(pad * elem, ALIGN);                       // bytes left of column 0
+    step = roundUp(lead + (cols + pad) * elem, ALIGN);
+    planeStep = step * (rows + 2 * pad);
+
+    storage.create(1, (int) (planeStep * channels + ALIGN), CV_8U);
+    uchar* base = (uchar*) roundUp((size_t) storage.data, ALIGN);
+    origin = base + pad * step + lead;
+}
+
+void PaddedImage::fill(int y0, int y1) {
+    assert(origin && 0 <= y0 && y0 < y1 && y1 <= rows);
+
+    // border rows with the first/last strip
+    int from = (y0 == 0) ? -pad : y0;
+    int to = (y1 == rows) ? rows + pad : y1;
+
+    for(int c = 0; c < channels; ++c) {
+        uchar* plane = origin + c * planeStep;
+
+        if(depth == CV_8U) fillPlane<uchar>(source, c, plane, step, pad, from, to);
+        else fillPlane<float>(source, c, plane, step, pad, from, to);
+    }
+}
+
+void PaddedImage::reserve(int pad) {
+    if(pad > this->pad && !source.empty()) create(source, pad);
+}
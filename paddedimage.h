@@ -0,0 +1,53 @@
+#ifndef PADDEDIMAGE_H
+#define PADDEDIMAGE_H
+
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+
+/* Planar copy of an input image for the cost kernels, built once per image.
+ * One plane per channel, column 0 of every row is 64 byte aligned and the borders are replicated
+ * by pad pixels on every side, so windows around any pixel are read without bounds checks.
+ * row<T>(c, y) points to column 0 of row y in plane c; rows -pad .. rows + pad - 1 and
+ * columns -pad .. cols + pad - 1 are valid. Supported depths: CV_8U, CV_32F.
+ * Copies share the data (like cv::Mat), the planes are read only after create().
+ * allocate() + fill() build it in row strips instead, e.g. while the source is still being
+ * produced: fill(y0, y1) copies source rows [y0, y1), the first/last strip also the border rows.
+ */
+class PaddedImage
+{
+public:
+    static const int ALIGN = 64;
+    static const int DEFAULT_PAD = 16;
+
+    int rows;
+    int cols;
+    int channels;
+    int depth;
+    int pad;
+
+    size_t step;            // bytes per row, multiple of ALIGN
+    size_t planeStep;       // bytes per plane
+
+    PaddedImage();
+    PaddedImage(const cv::Mat &image, int pad = DEFAULT_PAD);
+
+    void create(const cv::Mat &image, int pad = DEFAULT_PAD);
+    void reserve(int pad);      // rebuild with a larger border if needed
+
+    void allocate(const cv::Mat &image, int pad = DEFAULT_PAD);     // layout only, image is read by fill()
+    void fill(int y0, int y1);
+
+    bool empty() const { return origin == 0; }
+
+    template<typename T>
+    const T* row(int c, int y) const {
+        return (const T*) (origin + c * planeStep + (std::ptrdiff_t) y * (std::ptrdiff_t) step);
+    }
+
+private:
+    cv::Mat source;         // kept for reserve()
+    cv::Mat storage;
+    uchar* origin;          // plane 0, row 0, column 0
+};
+
+#endif // PADDEDIMAGE_H
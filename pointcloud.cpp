@@ -0,0 +1,142 @@
+#include "pointcloud.h"
+#include "trace.h"
+
+#include <vector>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+PointCloudWriter::PointCloudWriter() {
+    minDisparity = 1;
+    points = 0;
+    format = PLY;
+}
+
+PointCloudWriter::~PointCloudWriter() {
+    close();
+}
+
+// Q of a rectified pair with focal length (pixels), baseline and principal point
+void PointCloudWriter::setFocalBaseline(double focal, double baseline, Point2d principal) {
+    Q = Mat::zeros(4, 4, CV_64F);
+    Q.at<double>(0, 0) = 1;
+    Q.at<double>(0, 3) = -principal.x;
+    Q.at<double>(1, 1) = 1;
+    Q.at<double>(1, 3) = -principal.y;
+    Q.at<double>(2, 3) = focal;
+    Q.at<double>(3, 2) = 1.0 / baseline;
+}
+
+bool PointCloudWriter::open(const string &path, Format format) {
+    close();
+
+    out.open(path.c_str(), ios::binary);
+    if(!out) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    this->format = format;
+    points = 0;
+
+    if(format == PLY) {
+        out << "ply\nformat binary_little_endian 1.0\nelement vertex ";
+        countPos = out.tellp();
+        out << "0000000000\n";      // patched in close()
+        out << "property float x\nproperty float y\nproperty float z\n";
+        if(!color.empty()) out << "property uchar red\nproperty uchar green\nproperty uchar blue\n";
+        out << "end_header\n";
+    }
+
+    return true;
+}
+
+// reprojects a range of disparity rows, one output buffer per row keeps the file order
+class ReprojectBody : public ParallelLoopBody {
+public:
+    const Mat &disparity;
+    const Mat &color;
+    const double* q;
+    int minDisparity;
+    int y0;
+    vector<vector<char> > &rows;
+    size_t pointSize;
+
+    ReprojectBody(const Mat &disparity, const Mat &color, const double* q, int minDisparity, int y0,
+                  vector<vector<char> > &rows, size_t pointSize)
+        : disparity(disparity), color(color), q(q), minDisparity(minDisparity), y0(y0), rows(rows), pointSize(pointSize) {}
+
+    void operator()(const Range &range) const {
+        TRACE_SCOPE("output/reproject");
+
+        for(int y = range.start; y < range.end; ++y) {
+            const ushort* d = disparity.ptr<ushort>(y);
+            const Vec3b* c = color.empty() ? 0 : color.ptr<Vec3b>(y);
+            vector<char> &buf = rows[y - y0];
+            buf.resize(disparity.cols * pointSize);
+
+            // row constant parts of Q * [x y d 1]
+            double bx = q[1] * y + q[3], by = q[5] * y + q[7], bz = q[9] * y + q[11], bw = q[13] * y + q[15];
+
+            size_t n = 0;
+            for(int x = 0; x < disparity.cols; ++x) {
+                if(d[x] < minDisparity) continue;
+
+                double w = q[12] * x + q[14] * d[x] + bw;
+                if(w == 0) continue;
+
+                float p[3];
+                p[0] = (float) ((q[0] * x + q[2] * d[x] + bx) / w);
+                p[1] = (float) ((q[4] * x + q[6] * d[x] + by) / w);
+                p[2] = (float) ((q[8] * x + q[10] * d[x] + bz) / w);
+
+                char* dst = &buf[n * pointSize];
+                memcpy(dst, p, sizeof(p));
+                if(c) {
+                    dst[12] = c[x][2];      // BGR -> RGB
+                    dst[13] = c[x][1];
+                    dst[14] = c[x][0];
+                }
+                n++;
+            }
+            buf.resize(n * pointSize);
+        }
+    }
+};
+
+void PointCloudWriter::write(const Mat &disparity, int y0, int y1) {
+    assert(out.is_open() && disparity.type() == CV_16U);
+    assert(Q.rows == 4 && Q.cols == 4);
+    assert(color.empty() || (color.type() == CV_8UC3 && color.size() == disparity.size()));
+
+    TRACE_SCOPE("output/pointcloud");
+
+    Mat q;
+    Q.convertTo(q, CV_64F);
+    q = q.clone();
+
+    size_t pointSize = 3 * sizeof(float) + ((format == PLY && !color.empty()) ? 3 : 0);
+    vector<vector<char> > rows(y1 - y0);
+    parallel_for_(Range(y0, y1), ReprojectBody(disparity, format == PLY ? color : Mat(), q.ptr<double>(), minDisparity, y0, rows, pointSize));
+
+    for(size_t i = 0; i < rows.size(); ++i) {
+        if(rows[i].empty()) continue;
+        out.write(&rows[i][0], rows[i].size());
+        points += rows[i].size() / pointSize;
+    }
+}
+
+bool PointCloudWriter::close() {
+    if(!out.is_open()) return true;
+
+    if(format == PLY) {
+        out.seekp(countPos);
+        out << cv::format("%010lu", (unsigned long) points);
+    }
+
+    bool ok = out.good();
+    out.close();
+
+    return ok;
+}
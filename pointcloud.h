@@ -0,0 +1,41 @@
+#ifndef POINTCLOUD_H
+#define POINTCLOUD_H
+
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <string>
+
+/* Reprojection of disparity rows to 3D points, written while the rows are matched.
+ * Point = (X, Y, Z) / W with [X Y Z W] = Q * [x y d 1] (Q from stereoRectify or focal length /
+ * baseline). Disparities below minDisparity (0: unmatched border, occlusions) are skipped.
+ * PLY: binary little endian, float x y z (+ uchar red green blue with color).
+ * RAW: float x y z per point, no header.
+ */
+class PointCloudWriter
+{
+public:
+    enum Format { PLY, RAW };
+
+    cv::Mat Q;              // 4x4 CV_64F
+    cv::Mat color;          // optional, left image (CV_8UC3)
+    int minDisparity;
+    size_t points;          // written so far
+
+    PointCloudWriter();
+    ~PointCloudWriter();
+
+    void setFocalBaseline(double focal, double baseline, cv::Point2d principal);
+
+    bool open(const std::string &path, Format format = PLY);
+    void write(const cv::Mat &disparity, int y0, int y1);     // rows [y0, y1), reprojected in parallel
+    bool close();
+
+    bool isOpen() const { return out.is_open(); }
+
+private:
+    std::ofstream out;
+    Format format;
+    std::streampos countPos;    // PLY vertex count, patched in close()
+};
+
+#endif // POINTCLOUD_H
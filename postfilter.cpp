@@ -0,0 +1,280 @@
+#include "postfilter.h"
+#include "trace.h"
+
+#include <vector>
+
+using namespace std;
+using namespace cv;
+
+static inline int clampi(int v, int lo, int hi) {
+    return v < lo ? lo : (v > hi ? hi : v);
+}
+
+/*
+ * median
+ */
+class MedianBody : public ParallelLoopBody {
+public:
+    const Mat &src;
+    Mat &dst;
+    int radius;
+    int coarse;             // coarse bins of 16 levels
+
+    MedianBody(const Mat &src, Mat &dst, int radius, int coarse) : src(src), dst(dst), radius(radius), coarse(coarse) {}
+
+    void operator()(const Range &range) const {
+        TRACE_SCOPE("postfilter/median");
+
+        int cols = src.cols;
+        int rows = src.rows;
+        int r = radius;
+        int area = (2*r + 1) * (2*r + 1);
+
+        // column histograms of the current window rows, coarse and fine level
+        vector<ushort> colCoarse((size_t) cols * coarse, 0);
+        vector<ushort> colFine((size_t) cols * coarse * 16, 0);
+
+        vector<int> kCoarse(coarse);
+        vector<int> kFine((size_t) coarse * 16);
+        vector<int> updated(coarse);                  // column the fine level of a bin is valid for
+
+        for(int i = range.start - r; i <= range.start + r; ++i) {
+            const ushort* s = src.ptr<ushort>(clampi(i, 0, rows - 1));
+            for(int x = 0; x < cols; ++x) {
+                colCoarse[(size_t) x * coarse + (s[x] >> 4)]++;
+                colFine[(size_t) x * coarse * 16 + s[x]]++;
+            }
+        }
+
+        for(int y = range.start; y < range.end; ++y) {
+            if(y > range.start) {
+                const ushort* out = src.ptr<ushort>(clampi(y - r - 1, 0, rows - 1));
+                const ushort* in = src.ptr<ushort>(clampi(y + r, 0, rows - 1));
+                for(int x = 0; x < cols; ++x) {
+                    colCoarse[(size_t) x * coarse + (out[x] >> 4)]--;
+                    colFine[(size_t) x * coarse * 16 + out[x]]--;
+                    colCoarse[(size_t) x * coarse + (in[x] >> 4)]++;
+                    colFine[(size_t) x * coarse * 16 + in[x]]++;
+                }
+            }
+
+            fill(kCoarse.begin(), kCoarse.end(), 0);
+            fill(updated.begin(), updated.end(), -1);
+            int zeros = 0;          // invalid pixels in the window (fine bin 0)
+            for(int j = -r; j <= r; ++j) {
+                const ushort* c = &colCoarse[(size_t) clampi(j, 0, cols - 1) * coarse];
+                for(int b = 0; b < coarse; ++b) kCoarse[b] += c[b];
+                zeros += colFine[(size_t) clampi(j, 0, cols - 1) * coarse * 16];
+            }
+
+            ushort* d = dst.ptr<ushort>(y);
+            for(int x = 0; x < cols; ++x) {
+                if(x > 0) {
+                    const ushort* in = &colCoarse[(size_t) clampi(x + r, 0, cols - 1) * coarse];
+                    const ushort* out = &colCoarse[(size_t) clampi(x - r - 1, 0, cols - 1) * coarse];
+                    for(int b = 0; b < coarse; ++b) kCoarse[b] += in[b] - out[b];
+                    zeros += colFine[(size_t) clampi(x + r, 0, cols - 1) * coarse * 16]
+                           - colFine[(size_t) clampi(x - r - 1, 0, cols - 1) * coarse * 16];
+                }
+
+                // median of the valid pixels, the invalid ones sort first
+                if(zeros == area) {
+                    d[x] = 0;
+                    continue;
+                }
+                int half = zeros + (area - zeros) / 2;
+
+                // coarse bin of the median
+                int b = 0, count = 0;
+                while(count + kCoarse[b] <= half) count += kCoarse[b++];
+
+                // fine level of that bin: slide from the last column it was valid for, or rebuild
+                int* f = &kFine[(size_t) b * 16];
+                if(updated[b] < 0 || x - updated[b] > 2*r) {
+                    fill(f, f + 16, 0);
+                    for(int j = x - r; j <= x + r; ++j) {
+                        const ushort* c = &colFine[((size_t) clampi(j, 0, cols - 1) * coarse + b) * 16];
+                        for(int k = 0; k < 16; ++k) f[k] += c[k];
+                    }
+                }
+                else {
+                    for(int j = updated[b] + 1; j <= x; ++j) {
+                        const ushort* in = &colFine[((size_t) clampi(j + r, 0, cols - 1) * coarse + b) * 16];
+                        const ushort* out = &colFine[((size_t) clampi(j - r - 1, 0, cols - 1) * coarse + b) * 16];
+                        for(int k = 0; k < 16; ++k) f[k] += in[k] - out[k];
+                    }
+                }
+                updated[b] = x;
+
+                int k = 0;
+                while(count + f[k] <= half) count += f[k++];
+
+                d[x] = (ushort) (b * 16 + k);
+            }
+        }
+    }
+};
+
+void medianDisparity(const Mat &src, Mat &dst, int radius) {
+    assert(src.type() == CV_16U && radius >= 0 && radius <= 127);      // window counts fit into ushort
+
+    double maxVal;
+    minMaxLoc(src, 0, &maxVal);
+    int coarse = (int) maxVal / 16 + 1;
+
+    Mat out(src.size(), CV_16U);
+    int strips = min(getNumThreads(), max(src.rows / 32, 1));     // column histograms per strip
+    parallel_for_(Range(0, src.rows), MedianBody(src, out, radius, coarse), strips);
+    dst = out;
+}
+
+/*
+ * speckles
+ */
+static int findRoot(vector<int> &parent, int i) {
+    int root = i;
+    while(parent[root] != root) root = parent[root];
+
+    // path compression
+    while(parent[i] != root) {
+        int next = parent[i];
+        parent[i] = root;
+        i = next;
+    }
+
+    return root;
+}
+
+static void unite(vector<int> &parent, int a, int b) {
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if(a == b) return;
+
+    // smaller index becomes root, roots stay inside the strip of their first pixel
+    if(a < b) parent[b] = a;
+    else parent[a] = b;
+}
+
+class SpeckleBody : public ParallelLoopBody {
+public:
+    const Mat &disparity;
+    vector<int> &parent;
+    int maxDiff;
+    int rowsPerStrip;
+
+    SpeckleBody(const Mat &disparity, vector<int> &parent, int maxDiff, int rowsPerStrip)
+        : disparity(disparity), parent(parent), maxDiff(maxDiff), rowsPerStrip(rowsPerStrip) {}
+
+    void operator()(const Range &range) const {
+        TRACE_SCOPE("postfilter/speckles");
+
+        int cols = disparity.cols;
+        for(int s = range.start; s < range.end; ++s) {
+            int y0 = s * rowsPerStrip;
+            int y1 = min(y0 + rowsPerStrip, disparity.rows);
+
+            for(int y = y0; y < y1; ++y) {
+                const ushort* d = disparity.ptr<ushort>(y);
+                const ushort* up = (y > y0) ? disparity.ptr<ushort>(y - 1) : 0;
+
+                for(int x = 0; x < cols; ++x) {
+                    int i = y * cols + x;
+                    parent[i] = i;
+                    if(d[x] == 0) continue;
+
+                    if(x > 0 && d[x - 1] != 0 && abs(d[x] - d[x - 1]) <= maxDiff) unite(parent, i, i - 1);
+                    if(up && up[x] != 0 && abs(d[x] - up[x]) <= maxDiff) unite(parent, i, i - cols);
+                }
+            }
+        }
+    }
+};
+
+int removeSpeckles(Mat &disparity, int maxSize, int maxDiff) {
+    assert(disparity.type() == CV_16U);
+
+    int rows = disparity.rows;
+    int cols = disparity.cols;
+    vector<int> parent((size_t) rows * cols);
+
+    // strips in parallel, each only touches its own pixel indices
+    int rowsPerStrip = max(rows / max(getNumThreads(), 1), 16);
+    int strips = (rows + rowsPerStrip - 1) / rowsPerStrip;
+    parallel_for_(Range(0, strips), SpeckleBody(disparity, parent, maxDiff, rowsPerStrip), strips);
+
+    TRACE_SCOPE("postfilter/speckles");
+
+    // join along the strip borders
+    for(int y = rowsPerStrip; y < rows; y += rowsPerStrip) {
+        const ushort* d = disparity.ptr<ushort>(y);
+        const ushort* up = disparity.ptr<ushort>(y - 1);
+
+        for(int x = 0; x < cols; ++x) {
+            if(d[x] != 0 && up[x] != 0 && abs(d[x] - up[x]) <= maxDiff) unite(parent, y * cols + x, (y - 1) * cols + x);
+        }
+    }
+
+    // region sizes at the roots, the parent array is reused for the root of every pixel
+    vector<int> size((size_t) rows * cols, 0);
+    for(int i = 0; i < rows * cols; ++i) {
+        parent[i] = findRoot(parent, i);
+        size[parent[i]]++;
+    }
+
+    int removed = 0;
+    for(int y = 0; y < rows; ++y) {
+        ushort* d = disparity.ptr<ushort>(y);
+        for(int x = 0; x < cols; ++x) {
+            if(d[x] != 0 && size[parent[y * cols + x]] < maxSize) {
+                d[x] = 0;
+                removed++;
+            }
+        }
+    }
+
+    return removed;
+}
+
+/*
+ * occlusion fill
+ */
+class FillBody : public ParallelLoopBody {
+public:
+    Mat &disparity;
+
+    FillBody(Mat &disparity) : disparity(disparity) {}
+
+    void operator()(const Range &range) const {
+        TRACE_SCOPE("postfilter/fill");
+
+        int cols = disparity.cols;
+        for(int y = range.start; y < range.end; ++y) {
+            ushort* d = disparity.ptr<ushort>(y);
+
+            int x = 0;
+            while(x < cols) {
+                if(d[x] != 0) {
+                    x++;
+                    continue;
+                }
+
+                // run of invalid pixels [x, end)
+                int end = x;
+                while(end < cols && d[end] == 0) end++;
+
+                ushort left = (x > 0) ? d[x - 1] : 0;
+                ushort right = (end < cols) ? d[end] : 0;
+                ushort value = (left && right) ? min(left, right) : max(left, right);
+
+                for(int k = x; k < end; ++k) d[k] = value;
+                x = end;
+            }
+        }
+    }
+};
+
+void fillOcclusions(Mat &disparity) {
+    assert(disparity.type() == CV_16U);
+
+    parallel_for_(Range(0, disparity.rows), FillBody(disparity));
+}
@@ -0,0 +1,22 @@
+#ifndef POSTFILTER_H
+#define POSTFILTER_H
+
+#include <opencv2/opencv.hpp>
+
+/* Post processing of CV_16U disparity maps, 0 is an invalid disparity.
+ *
+ * medianDisparity: median of the valid pixels of a (2 radius + 1)^2 window in constant time per pixel
+ *   independent of the radius (column histograms with coarse/fine levels, Perreault & Hebert),
+ *   parallel strips. Pixels without valid neighbours stay invalid.
+ * removeSpeckles: invalidates connected regions (4 neighbours differ by <= maxDiff) with less than
+ *   maxSize pixels. Union-find over the pixel indices: one int per pixel, no recursion or flood fill
+ *   queue, strips are labeled in parallel and joined along their borders.
+ * fillOcclusions: every run of invalid pixels of a row gets the smaller (background) of its two
+ *   valid neighbours, parallel rows.
+ *   Occlusions are only invalid if the matcher marks them (BlockMatching::markOcclusions).
+ */
+void medianDisparity(const cv::Mat &src, cv::Mat &dst, int radius);
+int removeSpeckles(cv::Mat &disparity, int maxSize, int maxDiff);      // returns invalidated pixels
+void fillOcclusions(cv::Mat &disparity);
+
+#endif // POSTFILTER_H
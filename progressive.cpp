@@ -0,0 +1,124 @@
+#include "progressive.h"
+
+using namespace std;
+using namespace cv;
+
+ProgressiveMatcher::ProgressiveMatcher(double budget, int rowStep, int maxScale) {
+    this->budget = budget;
+    this->rowStep = max(rowStep, 1);
+    this->maxScale = max(maxScale, 1);
+}
+
+// smallest power of two scale whose pass is estimated to fit into budget
+int ProgressiveMatcher::firstScale(Size imageSize, int blocksize, double rowSeconds) {
+    double rows = imageSize.height - 2 * (blocksize / 2);
+    int scale = 1;
+
+    while(scale * 2 <= maxScale && rowSeconds * rows / ((double) scale * scale * scale) > budget) {
+        Size next(imageSize.width / (scale * 2), imageSize.height / (scale * 2));
+        if(next.width <= 2 * blocksize || next.height <= 2 * blocksize) break;     // image to small
+
+        scale *= 2;
+    }
+
+    return scale;
+}
+
+Mat ProgressiveMatcher::compute(BlockMatching &bm, Mat left, Mat right, CostFactory factory, int blocksize,
+                                PreviewCallback callback, void* user) {
+    TRACE_SCOPE("progressive");
+
+    assert(left.size() == right.size() && "image size not equal");
+
+    Size imageSize = left.size();
+    int margin = blocksize / 2;
+    int start = margin;
+    int stopH = imageSize.height - margin;
+
+    assert(stopH - start > 0);          // image to small
+
+    passes.clear();
+    int64 t0 = getTickCount();
+
+    Mat disparity = Mat::zeros(imageSize, CV_16U);
+    vector<bool> done(imageSize.height, false);
+
+    bm.prepare(blocksize);
+
+    // timing of one full resolution scanline, the row is part of the result
+    bm.computeLine(imageSize, blocksize, start, disparity);
+    done[start] = true;
+    double rowSeconds = (getTickCount() - t0) / getTickFrequency();
+
+    // coarse passes on downscaled images
+    for(int scale = firstScale(imageSize, blocksize, rowSeconds); scale > 1; scale /= 2) {
+        TRACE_SCOPE("progressive/coarse");
+
+        Size small(imageSize.width / scale, imageSize.height / scale);
+        Mat l, r;
+        resize(left, l, small, 0, 0, INTER_AREA);
+        resize(right, r, small, 0, 0, INTER_AREA);
+
+        BlockMatching coarse;
+        coarse.occlusionSouth = bm.occlusionSouth;
+        coarse.occlusionEast = bm.occlusionEast;
+        factory(coarse, l, r);
+
+        vector<int> lines;
+        for(int y = margin; y < small.height - margin; ++y)
+            lines.push_back(y);
+
+        Mat d = Mat::zeros(small, CV_16U);
+        coarse.prepare(blocksize);
+        coarse.computeLines(small, blocksize, lines, d);
+
+        // back to full size, disparities in full resolution pixels
+        Mat preview;
+        resize(d, preview, imageSize, 0, 0, INTER_NEAREST);
+        preview.convertTo(preview, CV_16U, scale);
+
+        PreviewPass pass = { scale, 1, (getTickCount() - t0) / getTickFrequency() };
+        passes.push_back(pass);
+        if(callback) callback(preview, (int) passes.size() - 1, user);
+    }
+
+    // full resolution, interleaved scanlines
+    int step = 1;
+    while(step * 2 <= rowStep) step *= 2;
+
+    for(; step >= 1; step /= 2) {
+        TRACE_SCOPE("progressive/rows");
+
+        for(int y = start; y < stopH; y += step) {
+            if(done[y]) continue;
+
+            bm.computeLine(imageSize, blocksize, y, disparity);
+            done[y] = true;
+        }
+
+        PreviewPass pass = { 1, step, (getTickCount() - t0) / getTickFrequency() };
+        passes.push_back(pass);
+        if(!callback) continue;
+
+        if(step == 1) {
+            callback(disparity, (int) passes.size() - 1, user);
+            continue;
+        }
+
+        // rows not matched yet repeat the matched row above
+        Mat preview = disparity.clone();
+        int src = start;
+        for(int y = start; y < stopH; ++y) {
+            if(done[y]) {
+                src = y;
+                continue;
+            }
+
+            Mat dst = preview.row(y);
+            disparity.row(src).copyTo(dst);
+        }
+        callback(preview, (int) passes.size() - 1, user);
+    }
+
+    return disparity;
+}
@@ -0,0 +1,44 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "blockmatching.h"
+#include "streaming.h"
+
+// called after every pass with the current full size estimate (CV_16U)
+typedef void (*PreviewCallback)(const cv::Mat &disparity, int pass, void* user);
+
+struct PreviewPass {
+    int scale;          // image downscale factor of the pass (1: full resolution)
+    int rowStep;        // scanlines (of the scaled image) matched so far are every rowStep-th
+    double seconds;     // wall time since the start of compute
+};
+
+/* Progressive matching for interactive use, time to the first usable result over total time.
+ * The cost of a scanline grows with width^2, a pass on images downscaled by s costs 1/s^3.
+ * One full resolution scanline is timed first, the first pass uses the smallest power of two
+ * scale which fits into budget. The following passes halve the scale, then the full resolution
+ * scanlines are filled in interleaved (every rowStep-th, then the rows in between, ...), rows
+ * not matched yet repeat the matched row above. The last pass equals BlockMatching::compute.
+ */
+class ProgressiveMatcher
+{
+public:
+    double budget;      // seconds for the first pass
+    int rowStep;        // first full resolution pass: every rowStep-th scanline (power of two)
+    int maxScale;
+
+    std::vector<PreviewPass> passes;
+
+    ProgressiveMatcher(double budget = 0.2, int rowStep = 8, int maxScale = 16);
+
+    // bm.functions have to be set up for (left, right), factory sets up the downscaled passes
+    cv::Mat compute(BlockMatching &bm, cv::Mat left, cv::Mat right, CostFactory factory, int blocksize,
+                    PreviewCallback callback, void* user = 0);
+
+private:
+    int firstScale(cv::Size imageSize, int blocksize, double rowSeconds);
+};
+
+#endif // PROGRESSIVE_H
@@ -0,0 +1,137 @@
+/*
+ * Python bindings (pybind11), build with cmake -DMYBM_PYTHON=ON
+ *
+ *   import mybm
+ *   m = mybm.Matcher(costs="rgb,census:0.5", blocksize=5, max_disparity=64)
+ *   disparity = m.compute(left, right)      # (h, w[, 3]) uint8 BGR/gray -> (h, w) uint16
+ *   m.timings                               # ms per stage of the last compute (profile=True)
+ *
+ * max_disparity limits the search to |x1 - x2| <= max_disparity and the dynamic programming to
+ * that band, -1 searches the full range.
+ *
+ * uint8 arrays with contiguous pixels are used in place, the disparity array owns the cv::Mat
+ * buffer. The GIL is released during preprocessing and matching.
+ */
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include <stdexcept>
+
+#include "blockmatching.h"
+#include "costfactory.h"
+#include "trace.h"
+
+namespace py = pybind11;
+
+using namespace std;
+using namespace cv;
+
+// Mat header on the numpy buffer
+static Mat wrap(py::array_t<uint8_t> &a) {
+    py::buffer_info info = a.request();
+    if(info.ndim != 2 && info.ndim != 3)
+        throw invalid_argument("image has to be (h, w) or (h, w, 3) uint8");
+
+    int channels = (info.ndim == 3) ? (int) info.shape[2] : 1;
+    if(channels != 1 && channels != 3)
+        throw invalid_argument("image has to have 1 or 3 channels");
+    if(info.strides[1] != channels || (info.ndim == 3 && info.strides[2] != 1))
+        throw invalid_argument("pixels of a row have to be contiguous");
+    if(info.strides[0] < info.shape[1] * channels)
+        throw invalid_argument("rows have to be stored top down without overlap");
+
+    return Mat((int) info.shape[0], (int) info.shape[1], CV_8UC(channels), info.ptr, (size_t) info.strides[0]);
+}
+
+// numpy array owning the Mat buffer
+static py::array toNumpy(const Mat &m) {
+    Mat* keep = new Mat(m);
+    py::capsule owner(keep, [](void* p) { delete (Mat*) p; });
+
+    return py::array_t<uint16_t>(
+        { (py::ssize_t) m.rows, (py::ssize_t) m.cols },
+        { (py::ssize_t) m.step[0], (py::ssize_t) sizeof(uint16_t) },
+        m.ptr<uint16_t>(), owner);
+}
+
+class Matcher {
+public:
+    string costs;
+    int blocksize;
+    int maxDisparity;       // search |x1 - x2| <= maxDisparity, < 0: full range
+    float occlusionSouth;
+    float occlusionEast;
+    bool profile;
+
+    map<string, double> timings;
+
+    Matcher(string costs, int blocksize, int maxDisparity, float occlusionSouth, float occlusionEast, bool profile)
+        : costs(costs), blocksize(blocksize), maxDisparity(maxDisparity),
+          occlusionSouth(occlusionSouth), occlusionEast(occlusionEast), profile(profile) {}
+
+    py::array compute(py::array_t<uint8_t> left, py::array_t<uint8_t> right) {
+        Mat l = wrap(left);
+        Mat r = wrap(right);
+
+        if(l.size() != r.size() || l.type() != r.type())
+            throw invalid_argument("image size/type not equal");
+        if(blocksize < 1 || blocksize % 2 == 0)
+            throw invalid_argument("blocksize has to be odd and >= 1");
+        if(l.cols <= 2 * blocksize || l.rows <= 2 * blocksize)
+            throw invalid_argument("image too small for the block size");
+        if(maxDisparity < -1)
+            throw invalid_argument("max_disparity must be >= 0, or -1 for the full range");
+
+        Mat disparity;
+        bool ok;
+        {
+            py::gil_scoped_release release;
+
+            // Trace is process wide, timings of concurrent computes mix
+            Trace::enabled = profile;
+            if(profile) Trace::clear();
+
+            // cost functions expect BGR
+            if(l.channels() == 1) {
+                cvtColor(l, l, COLOR_GRAY2BGR);
+                cvtColor(r, r, COLOR_GRAY2BGR);
+            }
+
+            BlockMatching bm;
+            bm.occlusionSouth = occlusionSouth;
+            bm.occlusionEast = occlusionEast;
+
+            if(maxDisparity >= 0) bm.setDisparityRange(-maxDisparity, maxDisparity);
+
+            ok = addCostFunctions(bm, costs, l, r, blocksize);        // row local preprocessing overlaps with compute()
+            if(ok) disparity = bm.compute(l.size(), blocksize);
+
+            if(profile) Trace::totals(timings);
+            else timings.clear();
+        }
+
+        if(!ok) throw invalid_argument("unknown cost function in " + costs);
+
+        return toNumpy(disparity);
+    }
+};
+
+PYBIND11_MODULE(mybm, m) {
+    m.doc() = "dynamic programming stereo block matching";
+
+    py::class_<Matcher>(m, "Matcher")
+        .def(py::init<string, int, int, float, float, bool>(),
+             py::arg("costs") = "rgb", py::arg("blocksize") = 3, py::arg("max_disparity") = -1,
+             py::arg("occlusion_south") = 1.0f, py::arg("occlusion_east") = 1.0f, py::arg("profile") = true,
+             "max_disparity: search |x1 - x2| <= max_disparity, -1 full range")
+        .def("compute", &Matcher::compute, py::arg("left"), py::arg("right"),
+             "disparity map (uint16) of a rectified BGR or gray uint8 pair")
+        .def_readwrite("costs", &Matcher::costs)
+        .def_readwrite("blocksize", &Matcher::blocksize)
+        .def_readwrite("max_disparity", &Matcher::maxDisparity)
+        .def_readwrite("occlusion_south", &Matcher::occlusionSouth)
+        .def_readwrite("occlusion_east", &Matcher::occlusionEast)
+        .def_readwrite("profile", &Matcher::profile)
+        .def_readonly("timings", &Matcher::timings);
+}
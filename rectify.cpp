@@ -0,0 +1,190 @@
+#include "rectify.h"
+#include "mappedfile.h"
+#include "trace.h"
+
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+static const char RECT_MAGIC[8] = { 'M', 'Y', 'B', 'M', 'R', 'C', 'T', '1' };
+
+// remap table cache: 64 byte header, then map1/map2 of the left and the right camera
+struct RectCacheHeader {
+    char magic[8];
+    int width;
+    int height;
+    uint64_t checksum;
+    int reserved[10];
+};
+
+bool StereoCalibration::load(const string &path) {
+    FileStorage fs(path, FileStorage::READ);
+    if(!fs.isOpened()) {
+        cout << "could not open calibration " << path << endl;
+        return false;
+    }
+
+    fs["M1"] >> M1;
+    fs["D1"] >> D1;
+    fs["M2"] >> M2;
+    fs["D2"] >> D2;
+    fs["R"] >> R;
+    fs["T"] >> T;
+
+    int width = 0, height = 0;
+    if(!fs["width"].empty()) fs["width"] >> width;
+    if(!fs["height"].empty()) fs["height"] >> height;
+    imageSize = Size(width, height);
+
+    if(M1.empty() || M2.empty() || R.empty() || T.empty()) {
+        cout << path << ": needs M1, D1, M2, D2, R and T" << endl;
+        return false;
+    }
+
+    return true;
+}
+
+// FNV-1a over the calibration values and the image size
+uint64_t StereoCalibration::checksum(Size size) const {
+    uint64_t h = 14695981039346656037ULL;
+    const Mat* mats[] = { &M1, &D1, &M2, &D2, &R, &T };
+
+    for(int m = 0; m < 6; ++m) {
+        Mat d;
+        mats[m]->convertTo(d, CV_64F);
+        d = d.clone();                      // continuous
+
+        const unsigned char* p = d.ptr();
+        for(size_t i = 0; i < d.total() * d.elemSize(); ++i)
+            h = (h ^ p[i]) * 1099511628211ULL;
+    }
+
+    int dims[2] = { size.width, size.height };
+    const unsigned char* p = (const unsigned char*) dims;
+    for(size_t i = 0; i < sizeof(dims); ++i)
+        h = (h ^ p[i]) * 1099511628211ULL;
+
+    return h;
+}
+
+bool Rectifier::load(const string &path) {
+    mapSize = Size();
+    return calib.load(path);
+}
+
+bool Rectifier::prepare(Size imageSize) {
+    if(imageSize == mapSize) return true;
+
+    TRACE_SCOPE("rectify/prepare");
+
+    if(calib.imageSize.area() > 0 && calib.imageSize != imageSize) {
+        cout << "images are " << imageSize.width << "x" << imageSize.height << ", calibration is for "
+             << calib.imageSize.width << "x" << calib.imageSize.height << endl;
+        return false;
+    }
+
+    Mat R1, R2, P1, P2;
+    stereoRectify(calib.M1, calib.D1, calib.M2, calib.D2, imageSize, calib.R, calib.T, R1, R2, P1, P2, Q,
+                  CALIB_ZERO_DISPARITY, 0);
+
+    uint64_t sum = calib.checksum(imageSize);
+    mapSize = imageSize;
+    if(!cachePath.empty() && loadCache(sum)) return true;
+
+    initUndistortRectifyMap(calib.M1, calib.D1, R1, P1, imageSize, CV_16SC2, map1[0], map2[0]);
+    initUndistortRectifyMap(calib.M2, calib.D2, R2, P2, imageSize, CV_16SC2, map1[1], map2[1]);
+
+    if(!cachePath.empty()) saveCache(sum);
+
+    return true;
+}
+
+bool Rectifier::loadCache(uint64_t checksum) {
+    MappedFile file;
+    if(!file.open(cachePath)) return false;
+
+    RectCacheHeader header;
+    size_t pixels = (size_t) mapSize.area();
+    size_t size = sizeof(header) + 2 * pixels * (2 * sizeof(short) + sizeof(ushort));
+
+    if(file.size != size) return false;
+    memcpy(&header, file.data, sizeof(header));
+    if(memcmp(header.magic, RECT_MAGIC, sizeof(RECT_MAGIC)) != 0 || header.checksum != checksum) return false;
+
+    // copy out of the mapping, remap() reads the tables every frame
+    unsigned char* p = file.data + sizeof(header);
+    for(int c = 0; c < 2; ++c) {
+        Mat(mapSize, CV_16SC2, p).copyTo(map1[c]);
+        p += pixels * 2 * sizeof(short);
+        Mat(mapSize, CV_16UC1, p).copyTo(map2[c]);
+        p += pixels * sizeof(ushort);
+    }
+
+    return true;
+}
+
+void Rectifier::saveCache(uint64_t checksum) {
+    size_t pixels = (size_t) mapSize.area();
+    size_t size = sizeof(RectCacheHeader) + 2 * pixels * (2 * sizeof(short) + sizeof(ushort));
+
+    MappedFile file;
+    if(!file.create(cachePath, size)) return;
+
+    RectCacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, RECT_MAGIC, sizeof(header.magic));
+    header.width = mapSize.width;
+    header.height = mapSize.height;
+    header.checksum = checksum;
+    memcpy(file.data, &header, sizeof(header));
+
+    unsigned char* p = file.data + sizeof(header);
+    for(int c = 0; c < 2; ++c) {
+        Mat m1(mapSize, CV_16SC2, p);
+        map1[c].copyTo(m1);
+        p += pixels * 2 * sizeof(short);
+
+        Mat m2(mapSize, CV_16UC1, p);
+        map2[c].copyTo(m2);
+        p += pixels * sizeof(ushort);
+    }
+
+    file.flush();
+}
+
+// remap of a strip of output rows
+class RemapBody : public ParallelLoopBody {
+public:
+    const Mat &src;
+    Mat &dst;
+    const Mat &map1;
+    const Mat &map2;
+
+    RemapBody(const Mat &src, Mat &dst, const Mat &map1, const Mat &map2) : src(src), dst(dst), map1(map1), map2(map2) {}
+
+    void operator()(const Range &range) const {
+        TRACE_SCOPE("rectify/strip");
+
+        Mat d = dst.rowRange(range.start, range.end);
+        remap(src, d, map1.rowRange(range.start, range.end), map2.rowRange(range.start, range.end),
+              INTER_LINEAR, BORDER_CONSTANT);
+    }
+};
+
+bool Rectifier::rectify(const Mat &left, const Mat &right, Mat &outLeft, Mat &outRight) {
+    TRACE_SCOPE("rectify");
+
+    assert(left.size() == right.size() && left.type() == right.type());
+    if(!prepare(left.size())) return false;
+
+    // no reallocation for frames of the same size
+    outLeft.create(left.size(), left.type());
+    outRight.create(right.size(), right.type());
+
+    int strips = max(left.rows / 64, 1);
+    parallel_for_(Range(0, left.rows), RemapBody(left, outLeft, map1[0], map2[0]), strips);
+    parallel_for_(Range(0, right.rows), RemapBody(right, outRight, map1[1], map2[1]), strips);
+
+    return true;
+}
@@ -0,0 +1,47 @@
+#ifndef RECTIFY_H
+#define RECTIFY_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <stdint.h>
+
+/* Stereo calibration, OpenCV FileStorage (YAML/XML) with the nodes of the stereo_calib sample:
+ * M1, D1, M2, D2 (intrinsics, distortion), R, T (right camera relative to left),
+ * optional width/height of the calibrated images.
+ */
+struct StereoCalibration {
+    cv::Mat M1, D1, M2, D2, R, T;
+    cv::Size imageSize;     // 0 x 0 if not stored
+
+    bool load(const std::string &path);
+    uint64_t checksum(cv::Size size) const;        // identifies the remap tables for size
+};
+
+/* Rectification input stage.
+ * The remap tables (fixed point, CV_16SC2 + CV_16UC1) are built once per image size and kept in
+ * memory, optionally in a memory mapped cache file (rebuilt if calibration or size differ).
+ * rectify() remaps in parallel horizontal strips into the output images, which are reused
+ * between frames of the same size.
+ */
+class Rectifier
+{
+public:
+    StereoCalibration calib;
+    std::string cachePath;      // on disk cache of the remap tables, empty: memory only
+
+    cv::Mat Q;                  // disparity to depth mapping of the rectified pair (cv::reprojectImageTo3D)
+
+    bool load(const std::string &path);
+    bool prepare(cv::Size imageSize);
+    bool rectify(const cv::Mat &left, const cv::Mat &right, cv::Mat &outLeft, cv::Mat &outRight);
+
+private:
+    cv::Size mapSize;
+    cv::Mat map1[2];            // per camera: integer coordinates
+    cv::Mat map2[2];            //             interpolation table index
+
+    bool loadCache(uint64_t checksum);
+    void saveCache(uint64_t checksum);
+};
+
+#endif // RECTIFY_H
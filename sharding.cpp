@@ -0,0 +1,179 @@
+#include "sharding.h"
+
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+
+using namespace std;
+using namespace cv;
+
+ShardCoordinator::ShardCoordinator(int workers) {
+    this->workers = max(workers, 1);
+    context = 1;
+    pin = true;
+    markOcclusions = false;
+    minDisparity = -BlockMatching::FULL_RANGE;
+    maxDisparity = BlockMatching::FULL_RANGE;
+    robust = false;
+}
+
+// "0-3,8-11"
+static vector<int> parseCpuList(const string &list) {
+    vector<int> cpus;
+    stringstream ss(list);
+    string item;
+
+    while(getline(ss, item, ',')) {
+        if(item.empty()) continue;
+
+        int first, last;
+        size_t dash = item.find('-');
+        first = atoi(item.substr(0, dash).c_str());
+        last = (dash == string::npos) ? first : atoi(item.substr(dash + 1).c_str());
+
+        for(int c = first; c <= last; ++c)
+            cpus.push_back(c);
+    }
+
+    return cpus;
+}
+
+vector<vector<int> > ShardCoordinator::numaNodes() {
+    vector<vector<int> > nodes;
+
+    for(int n = 0; ; ++n) {
+        ifstream in(format("/sys/devices/system/node/node%d/cpulist", n).c_str());
+        if(!in) break;
+
+        string list;
+        getline(in, list);
+        nodes.push_back(parseCpuList(list));
+    }
+
+    return nodes;
+}
+
+static bool pinToCpus(const vector<int> &cpus) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(size_t i = 0; i < cpus.size(); ++i)
+        CPU_SET(cpus[i], &set);
+
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+bool ShardCoordinator::compute(Mat left, Mat right, CostFactory factory, int blocksize,
+                               float occlusionSouth, float occlusionEast, Mat &disparity) {
+    TRACE_SCOPE("shards");
+
+    assert(left.size() == right.size() && "image size not equal");
+
+    int width = left.cols;
+    int height = left.rows;
+    int margin = blocksize / 2;
+    int band = margin + context;
+    int start = margin;
+    int stopH = height - margin;
+
+    assert(stopH - start > 0);          // image to small
+
+    int shards = min(workers, stopH - start);
+    vector<vector<int> > nodes = pin ? numaNodes() : vector<vector<int> >();
+
+    // disparity rows and stats, shared with the workers
+    size_t outBytes = (size_t) width * height * sizeof(ushort);
+    size_t size = outBytes + shards * sizeof(ShardStats);
+    void* shared = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if(shared == MAP_FAILED) {
+        cout << "could not map " << size << " bytes of shared memory" << endl;
+        return false;
+    }
+    memset(shared, 0, size);
+
+    Mat out(height, width, CV_16U, shared);
+    ShardStats* shardStats = (ShardStats*) ((char*) shared + outBytes);
+
+    vector<pid_t> pids;
+    for(int s = 0; s < shards; ++s) {
+        ShardStats &st = shardStats[s];
+        st.y0 = start + (int) ((long long) (stopH - start) * s / shards);
+        st.y1 = start + (int) ((long long) (stopH - start) * (s + 1) / shards);
+        st.node = nodes.empty() ? -1 : s % (int) nodes.size();
+        st.seconds = 0;
+        st.status = -1;
+
+        pid_t pid = fork();
+        if(pid < 0) {
+            cout << "could not start worker " << s << endl;
+            break;
+        }
+        if(pid > 0) {
+            pids.push_back(pid);
+            continue;
+        }
+
+        // worker: the thread pool of the coordinator does not survive the fork, switch to
+        // sequential before any parallel code runs (one process per core)
+        setNumThreads(0);
+
+        try {
+            // pin before allocating, so the preprocessed images are node local
+            int64 t = getTickCount();
+            if(st.node >= 0 && !pinToCpus(nodes[st.node])) st.node = -1;
+
+            int in0 = max(st.y0 - band, 0);
+            int in1 = min(st.y1 + band, height);
+            Mat l = left.rowRange(in0, in1).clone();
+            Mat r = right.rowRange(in0, in1).clone();
+
+            BlockMatching bm;
+            bm.occlusionSouth = occlusionSouth;
+            bm.occlusionEast = occlusionEast;
+            bm.markOcclusions = markOcclusions;
+            bm.setDisparityRange(minDisparity, maxDisparity);
+            factory(bm, l, r);
+            for(size_t i = 0; robust && i < bm.functions.size(); ++i)
+                bm.functions[i]->setRobust(true);
+
+            vector<int> lines;
+            for(int y = st.y0; y < st.y1; ++y)
+                lines.push_back(y - in0);
+
+            Mat d = Mat::zeros(in1 - in0, width, CV_16U);
+            bm.prepare(blocksize);
+            bm.computeLines(l.size(), blocksize, lines, d);
+
+            Mat dst = out.rowRange(st.y0, st.y1);
+            d.rowRange(st.y0 - in0, st.y1 - in0).copyTo(dst);
+
+            st.seconds = (getTickCount() - t) / getTickFrequency();
+            st.status = 0;
+        }
+        catch(...) {
+            _exit(1);   // never return into the coordinator's code
+        }
+        _exit(0);       // no destructors/atexit handlers of the coordinator
+    }
+
+    bool ok = (int) pids.size() == shards;
+    for(size_t s = 0; s < pids.size(); ++s) {
+        int status = 0;
+        waitpid(pids[s], &status, 0);
+
+        if(!WIFEXITED(status) || WEXITSTATUS(status) != 0 || shardStats[s].status != 0) {
+            cout << "worker " << s << " (rows " << shardStats[s].y0 << " - " << shardStats[s].y1 << ") failed" << endl;
+            ok = false;
+        }
+    }
+
+    stats.assign(shardStats, shardStats + shards);
+    if(ok) disparity = out.clone();
+
+    munmap(shared, size);
+    return ok;
+}
@@ -0,0 +1,47 @@
+#ifndef SHARDING_H
+#define SHARDING_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include "blockmatching.h"
+#include "streaming.h"
+
+// per shard statistics, written by the worker process
+struct ShardStats {
+    int y0, y1;             // output rows [y0, y1)
+    int node;               // NUMA node the worker was pinned to (-1: not pinned)
+    double seconds;         // wall time of the worker
+    int status;             // exit status of the worker (0: ok)
+};
+
+/* Multi process row sharding on one machine.
+ * The scanlines are split into one band per worker. Each worker is a forked process (inputs are
+ * shared copy on write) which pins itself to a NUMA node (round robin over the nodes of
+ * /sys/devices/system/node), sets up its cost functions on its input rows (+ blocksize / 2 +
+ * context rows overlap, like StripMatcher) and writes its disparity rows into an anonymous shared
+ * mapping. The coordinator waits for all workers, the stitched map equals BlockMatching::compute
+ * for cost functions without global preprocessing (CondHistCost only sees its band).
+ */
+class ShardCoordinator
+{
+public:
+    int workers;
+    int context;            // additional input rows of preprocessing filters (1 for the 3x3 scharr)
+    bool pin;               // pin workers to NUMA nodes
+    bool markOcclusions;    // see BlockMatching::markOcclusions
+    int minDisparity;       // search range of every worker, see BlockMatching::setDisparityRange
+    int maxDisparity;
+    bool robust;            // see CostFunction::setRobust
+
+    std::vector<ShardStats> stats;
+
+    ShardCoordinator(int workers);
+
+    bool compute(cv::Mat left, cv::Mat right, CostFactory factory, int blocksize,
+                 float occlusionSouth, float occlusionEast, cv::Mat &disparity);
+
+    // cpus per NUMA node, empty if the system does not report nodes
+    static std::vector<std::vector<int> > numaNodes();
+};
+
+#endif // SHARDING_H
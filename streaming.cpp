@@ -0,0 +1,83 @@
+#include "streaming.h"
+
+using namespace std;
+using namespace cv;
+
+StripMatcher::StripMatcher(size_t memCap) {
+    this->memCap = memCap;
+    context = 1;
+    preprocessBytes = 24;       // e.g. two CV_32FC3 gradient images of GradientCost
+}
+
+// largest number of output rows per strip which fits into memCap
+int StripMatcher::stripHeight(int width, int channels, int blocksize) {
+    int margin = blocksize / 2;
+    int band = margin + context;
+    size_t workSpace = width - 2 * margin;
+
+    // one disparity space image + sum (float) + dirs (ushort) per scanline
+    size_t fixed = workSpace * workSpace * (sizeof(float) * 2 + sizeof(ushort));
+
+    // mapped input rows (left, right), BGR strip copies, preprocessed images, disparity
+    size_t perInputRow = (size_t) width * (2 * channels + 2 * 3 + preprocessBytes);
+    size_t perOutputRow = (size_t) width * sizeof(ushort);
+
+    size_t overhead = fixed + 2 * band * perInputRow;
+    if(memCap <= overhead) return 0;
+
+    return (int) ((memCap - overhead) / (perInputRow + perOutputRow));
+}
+
+bool StripMatcher::compute(StripReader &left, StripReader &right, CostFactory factory, int blocksize, PGM16Writer &out) {
+    assert(left.width == right.width && left.height == right.height && "image size not equal");
+
+    int width = left.width;
+    int height = left.height;
+    int margin = blocksize / 2;
+    int band = margin + context;
+
+    int strip = min(stripHeight(width, max(left.channels, right.channels), blocksize), height);
+    if(strip < 1) {
+        cout << "memory cap of " << memCap / (1024*1024) << " MB too small for width " << width << endl;
+        return false;
+    }
+
+    cout << "streaming " << width << "x" << height << " in strips of " << strip << " rows: " << flush;
+
+    int released = 0;
+    for(int y0 = 0; y0 < height; y0 += strip) {
+        int y1 = min(y0 + strip, height);
+
+        // input rows the strip depends on
+        int in0 = max(y0 - band, 0);
+        int in1 = min(y1 + band, height);
+
+        Mat l = left.rows(in0, in1);
+        Mat r = right.rows(in0, in1);
+
+        BlockMatching bm;
+        factory(bm, l, r);
+
+        // scanlines of this strip the matcher can work on, in strip coordinates
+        vector<int> lines;
+        for(int y = max(y0, margin); y < min(y1, height - margin); ++y)
+            lines.push_back(y - in0);
+
+        Mat disparity = Mat::zeros(in1 - in0, width, CV_16U);
+        bm.prepare(blocksize);
+        bm.computeLines(l.size(), blocksize, lines, disparity);
+
+        out.write(disparity.rowRange(y0 - in0, y1 - in0));
+
+        // rows above the next strip's input are not needed anymore
+        int next = max(y1 - band, 0);
+        left.release(released, next);
+        right.release(released, next);
+        released = max(released, next);
+
+        cout << (y1 * 100) / height << "%, " << flush;
+    }
+    cout << endl;
+
+    return true;
+}
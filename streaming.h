@@ -0,0 +1,30 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include "blockmatching.h"
+#include "stripio.h"
+
+// sets up the cost functions of bm for a pair of (strip) images
+typedef void (*CostFactory)(BlockMatching &bm, cv::Mat left, cv::Mat right);
+
+/* Strip streaming for inputs which do not fit into memory.
+ * Every disparity row only needs blocksize input rows, so the image is matched in horizontal strips:
+ * read strip (+ margin rows above and below) -> set up cost functions -> match -> append to output.
+ * The strip height is derived from memCap, peak memory does not depend on the image height.
+ */
+class StripMatcher
+{
+public:
+    size_t memCap;              // bytes
+    int context;                // additional input rows of preprocessing filters (1 for the 3x3 scharr)
+    int preprocessBytes;        // bytes per pixel the cost functions allocate for both images (estimate)
+
+    StripMatcher(size_t memCap);
+
+    int stripHeight(int width, int channels, int blocksize);
+    bool compute(StripReader &left, StripReader &right, CostFactory factory, int blocksize, PGM16Writer &out);
+};
+
+#endif // STREAMING_H
@@ -0,0 +1,188 @@
+#include "stripio.h"
+
+using namespace std;
+using namespace cv;
+
+StripReader::StripReader() {
+    width = 0;
+    height = 0;
+    channels = 0;
+    offset = 0;
+    rgb = false;
+}
+
+// read the next ascii header token, skips whitespace and comments
+static bool pnmToken(const unsigned char* data, size_t size, size_t &pos, int &value) {
+    while(pos < size) {
+        if(data[pos] == '#') {
+            while(pos < size && data[pos] != '\n') pos++;
+        }
+        else if(isspace(data[pos])) {
+            pos++;
+        }
+        else {
+            break;
+        }
+    }
+
+    if(pos >= size || !isdigit(data[pos])) return false;
+
+    value = 0;
+    while(pos < size && isdigit(data[pos])) {
+        value = value * 10 + (data[pos] - '0');
+        pos++;
+    }
+
+    return true;
+}
+
+bool StripReader::openPNM(const string &path) {
+    if(!file.open(path)) return false;
+
+    if(file.size < 2 || file.data[0] != 'P' || (file.data[1] != '5' && file.data[1] != '6')) {
+        cout << path << ": only binary PGM (P5) and PPM (P6) can be streamed" << endl;
+        close();
+        return false;
+    }
+
+    channels = file.data[1] == '5' ? 1 : 3;
+    rgb = channels == 3;
+
+    size_t pos = 2;
+    int maxval = 0;
+    if(!pnmToken(file.data, file.size, pos, width) ||
+       !pnmToken(file.data, file.size, pos, height) ||
+       !pnmToken(file.data, file.size, pos, maxval)) {
+        cout << path << ": broken PNM header" << endl;
+        close();
+        return false;
+    }
+
+    if(maxval > 255) {
+        cout << path << ": only 8 bit PNM files can be streamed" << endl;
+        close();
+        return false;
+    }
+
+    offset = pos + 1;   // single whitespace after maxval
+
+    if(offset + rowBytes() * height > file.size) {
+        cout << path << ": file is truncated" << endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+bool StripReader::openRaw(const string &path, int width, int height, int channels) {
+    assert(channels == 1 || channels == 3);
+
+    if(!file.open(path)) return false;
+
+    this->width = width;
+    this->height = height;
+    this->channels = channels;
+    offset = 0;
+    rgb = false;
+
+    if(rowBytes() * height > file.size) {
+        cout << path << ": file smaller than " << width << "x" << height << "x" << channels << endl;
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+Mat StripReader::rows(int y0, int y1) {
+    assert(file.isOpen());
+    assert(0 <= y0 && y0 < y1 && y1 <= height);
+
+    size_t start = offset + rowBytes() * y0;
+    file.prefetch(start, rowBytes() * (y1 - y0));
+
+    // header over the mapping, no copy yet
+    Mat mapped(y1 - y0, width, CV_8UC(channels), file.data + start, rowBytes());
+
+    Mat strip;
+    if(channels == 1) {
+        cvtColor(mapped, strip, COLOR_GRAY2BGR);
+    }
+    else if(rgb) {
+        cvtColor(mapped, strip, COLOR_RGB2BGR);
+    }
+    else {
+        strip = mapped.clone();
+    }
+
+    return strip;
+}
+
+void StripReader::release(int y0, int y1) {
+    if(y1 <= y0) return;
+
+    file.release(offset + rowBytes() * y0, rowBytes() * (y1 - y0));
+}
+
+void StripReader::close() {
+    file.close();
+    width = 0;
+    height = 0;
+    channels = 0;
+}
+
+PGM16Writer::PGM16Writer() {
+    width = 0;
+    height = 0;
+    written = 0;
+}
+
+PGM16Writer::~PGM16Writer() {
+    if(out.is_open()) close();
+}
+
+bool PGM16Writer::open(const string &path, int width, int height) {
+    out.open(path.c_str(), ios::out | ios::binary | ios::trunc);
+    if(!out) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    this->width = width;
+    this->height = height;
+    written = 0;
+
+    out << "P5\n" << width << " " << height << "\n65535\n";
+    buffer.resize((size_t) width * 2);
+
+    return true;
+}
+
+void PGM16Writer::write(Mat strip) {
+    assert(strip.type() == CV_16U && strip.cols == width);
+    assert(written + strip.rows <= height);
+
+    for(int y = 0; y < strip.rows; ++y) {
+        const ushort* ptr = strip.ptr<ushort>(y);
+
+        // PGM samples are big endian
+        for(int x = 0; x < width; ++x) {
+            buffer[2*x] = (uchar) (ptr[x] >> 8);
+            buffer[2*x + 1] = (uchar) (ptr[x] & 0xFF);
+        }
+
+        out.write((const char*) &buffer[0], buffer.size());
+    }
+
+    written += strip.rows;
+}
+
+bool PGM16Writer::close() {
+    bool ok = written == height && out.good();
+    if(written != height) cout << "PGM incomplete: " << written << "/" << height << " rows" << endl;
+
+    out.close();
+
+    return ok;
+}
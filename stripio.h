@@ -0,0 +1,58 @@
+#ifndef STRIPIO_H
+#define STRIPIO_H
+
+#include <opencv2/opencv.hpp>
+#include <fstream>
+#include <string>
+#include "mappedfile.h"
+
+/* Reads an image in horizontal strips from a memory mapped file.
+ * Supported: binary PGM (P5) / PPM (P6) with 8 bit samples and raw interleaved 8 bit BGR/gray data.
+ * Only the pages of the requested rows are touched, consumed rows can be dropped with release().
+ */
+class StripReader
+{
+public:
+    int width;
+    int height;
+    int channels;
+
+    StripReader();
+
+    bool openPNM(const std::string &path);
+    bool openRaw(const std::string &path, int width, int height, int channels);
+
+    // rows [y0, y1) as 8 bit BGR image (copy, the mapping stays read only)
+    cv::Mat rows(int y0, int y1);
+    void release(int y0, int y1);
+    void close();
+
+private:
+    MappedFile file;
+    size_t offset;      // first pixel byte
+    bool rgb;           // PPM stores RGB, opencv wants BGR
+
+    size_t rowBytes() const { return (size_t) width * channels; }
+};
+
+// Writes a 16 bit binary PGM (P5, maxval 65535) strip by strip
+class PGM16Writer
+{
+public:
+    int width;
+    int height;
+    int written;        // rows written so far
+
+    PGM16Writer();
+    ~PGM16Writer();
+
+    bool open(const std::string &path, int width, int height);
+    void write(cv::Mat strip);          // CV_16U rows, appended
+    bool close();
+
+private:
+    std::ofstream out;
+    std::vector<uchar> buffer;
+};
+
+#endif // STRIPIO_H
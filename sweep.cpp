@@ -0,0 +1,137 @@
+#include "sweep.h"
+#include "dpmat.h"
+
+using namespace std;
+using namespace cv;
+
+// runs a range of settings on the per function disparity spaces of one scanline
+class SweepLineBody : public ParallelLoopBody {
+public:
+    BlockMatching &bm;
+    vector<Mat> &maps;
+    const DSIBand &band;
+    vector<SweepResult> &results;
+    int y;
+    int margin;
+
+    SweepLineBody(BlockMatching &bm, vector<Mat> &maps, const DSIBand &band, vector<SweepResult> &results, int y, int margin)
+        : bm(bm), maps(maps), band(band), results(results), y(y), margin(margin) {}
+
+    void operator()(const Range &range) const {
+        for(int k = range.start; k < range.end; ++k) {
+            SweepResult &r = results[k];
+            int64 start = getTickCount();
+
+            TRACE_SCOPE("sweep/setting");
+            Mat combined = bm.combineDisparitySpace(maps, r.setting.weights);
+
+            Mat sum, dirs;
+            DPmat::preCalc(combined, band, sum, dirs, r.setting.occlusionSouth, r.setting.occlusionEast);
+            DPmat::disparityFromDirs(sum, dirs, band, r.disparity, y, margin, margin);
+
+            r.seconds += (getTickCount() - start) / getTickFrequency();
+        }
+    }
+};
+
+ParameterSweep::ParameterSweep() {
+    costSeconds = 0;
+}
+
+void ParameterSweep::grid(size_t functions, const vector<float> &weights, const vector<float> &occlusions) {
+    assert(functions > 0 && !weights.empty() && !occlusions.empty());
+
+    settings.clear();
+
+    size_t combinations = 1;
+    for(size_t i = 0; i < functions; ++i) combinations *= weights.size();
+
+    for(size_t o = 0; o < occlusions.size(); ++o) {
+        for(size_t c = 0; c < combinations; ++c) {
+            SweepSetting s;
+            s.occlusionSouth = occlusions[o];
+            s.occlusionEast = occlusions[o];
+
+            // c as number in base weights.size(), one digit per function
+            size_t rest = c;
+            for(size_t i = 0; i < functions; ++i) {
+                s.weights.push_back(weights[rest % weights.size()]);
+                rest /= weights.size();
+            }
+
+            settings.push_back(s);
+        }
+    }
+}
+
+vector<SweepResult> ParameterSweep::run(BlockMatching &bm, Size imageSize, int blocksize) {
+    assert(!settings.empty());
+
+    int margin = blocksize / 2;
+    int start = margin;
+    int stopH = imageSize.height - margin;
+    int stopW = imageSize.width - margin;
+
+    assert(stopH - start > 0);          // image to small
+    assert(stopW - start > 0);          // image to small
+
+    vector<SweepResult> results(settings.size());
+    for(size_t k = 0; k < settings.size(); ++k) {
+        assert(settings[k].weights.size() == bm.functions.size());
+
+        results[k].setting = settings[k];
+        results[k].disparity = Mat::zeros(imageSize, CV_16U);
+        results[k].seconds = 0;
+    }
+
+    bm.prepare(blocksize);
+    costSeconds = 0;
+
+    cout << "sweep " << settings.size() << " settings: " << flush;
+    int tenpercent = max((stopH - start) / 10, 1);
+
+    vector<Mat> maps;
+    DSIBand band;
+    for(int y = start; y < stopH; ++y) {
+        int64 t = getTickCount();
+        bm.disparitySpaces(imageSize, blocksize, y, maps, band);
+        costSeconds += (getTickCount() - t) / getTickFrequency();
+
+        parallel_for_(Range(0, (int) results.size()), SweepLineBody(bm, maps, band, results, y, margin));
+
+        if(((stopH - y) % tenpercent) == 0) cout << (((stopH - y)*10) / tenpercent) << "%, " << flush;
+    }
+    cout << endl;
+
+    // statistics over the matched area
+    Rect area(margin, margin, stopW - start, stopH - start);
+    for(size_t k = 0; k < results.size(); ++k) {
+        Mat d = results[k].disparity(area);
+
+        Scalar mean, stddev;
+        meanStdDev(d, mean, stddev);
+        minMaxLoc(d, &results[k].minVal, &results[k].maxVal);
+
+        results[k].mean = mean[0];
+        results[k].stddev = stddev[0];
+    }
+
+    return results;
+}
+
+void ParameterSweep::printTable(const vector<SweepResult> &results, ostream &out) {
+    out << "cost stage (shared): " << costSeconds << " seconds" << endl;
+    out << "#\tweights\tocc_south\tocc_east\tseconds\tmean\tstddev\tmin\tmax" << endl;
+
+    for(size_t k = 0; k < results.size(); ++k) {
+        const SweepResult &r = results[k];
+
+        out << k << "\t";
+        for(size_t i = 0; i < r.setting.weights.size(); ++i)
+            out << (i ? "," : "") << r.setting.weights[i];
+
+        out << "\t" << r.setting.occlusionSouth << "\t" << r.setting.occlusionEast
+            << "\t" << r.seconds << "\t" << r.mean << "\t" << r.stddev
+            << "\t" << r.minVal << "\t" << r.maxVal << endl;
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+#include <ostream>
+#include "blockmatching.h"
+
+// one parameter combination: weight per cost function, dynamic programming penalties
+struct SweepSetting {
+    std::vector<float> weights;
+    float occlusionSouth;
+    float occlusionEast;
+};
+
+struct SweepResult {
+    SweepSetting setting;
+    cv::Mat disparity;
+
+    double seconds;         // combine + dynamic programming, summed over all scanlines
+    double mean;            // disparity statistics over the matched area
+    double stddev;
+    double minVal;
+    double maxVal;
+};
+
+/* Parameter sweep over cost function weights and occlusion penalties.
+ * The disparity space image of every cost function is computed once per scanline, then each
+ * setting only recombines them (combineDisparitySpace) and reruns DPmat, settings run in parallel.
+ * Weights are factors on top of the lambda the cost functions were created with.
+ */
+class ParameterSweep
+{
+public:
+    std::vector<SweepSetting> settings;
+    double costSeconds;     // shared cost stage
+
+    ParameterSweep();
+
+    // cartesian product: every function gets every weight, occlusion south == east
+    void grid(size_t functions, const std::vector<float> &weights, const std::vector<float> &occlusions);
+
+    std::vector<SweepResult> run(BlockMatching &bm, cv::Size imageSize, int blocksize);
+    void printTable(const std::vector<SweepResult> &results, std::ostream &out);
+};
+
+#endif // SWEEP_H
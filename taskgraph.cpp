@@ -0,0 +1,181 @@
+#include "taskgraph.h"
+#include "trace.h"
+
+#include <opencv2/opencv.hpp>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+
+using namespace std;
+using namespace cv;
+
+static thread_local bool insideTask = false;
+
+int TaskGraph::add(const char* name, Func func, const vector<int> &deps) {
+    Task t;
+    t.name = name;
+    t.func = func;
+    t.deps = deps;
+
+    for(size_t i = 0; i < deps.size(); ++i)
+        assert(deps[i] >= 0 && deps[i] < (int) tasks.size() && "dependencies have to exist");
+
+    tasks.push_back(t);
+    return (int) tasks.size() - 1;
+}
+
+int TaskGraph::add(const char* name, Func func, int dep) {
+    return add(name, func, vector<int>(1, dep));
+}
+
+static void execute(const char* name, const TaskGraph::Func &func) {
+    TRACE_SCOPE(name);
+    func();
+}
+
+void TaskGraph::run() {
+    int n = (int) tasks.size();
+    int workers = min(max(getNumThreads(), 1), n);
+
+    // tasks are added after their dependencies, so the insertion order is a valid order
+    if(insideTask || workers <= 1) {
+        for(int i = 0; i < n; ++i) execute(tasks[i].name, tasks[i].func);
+        return;
+    }
+
+    vector<int> waiting(n);
+    vector<vector<int> > dependents(n);
+    vector<int> ready;
+
+    for(int i = 0; i < n; ++i) {
+        waiting[i] = (int) tasks[i].deps.size();
+        for(size_t d = 0; d < tasks[i].deps.size(); ++d)
+            dependents[tasks[i].deps[d]].push_back(i);
+
+        if(!waiting[i]) ready.push_back(i);
+    }
+    reverse(ready.begin(), ready.end());       // pop_back() takes them in insertion order
+
+    mutex m;
+    condition_variable wake;
+    int done = 0;
+    exception_ptr error;
+
+    auto worker = [&]() {
+        insideTask = true;
+        unique_lock<mutex> lock(m);
+
+        while(true) {
+            wake.wait(lock, [&]() { return !ready.empty() || done == n || error; });
+            if(done == n || error) break;
+
+            int t = ready.back();
+            ready.pop_back();
+
+            lock.unlock();
+            exception_ptr e;
+            try {
+                execute(tasks[t].name, tasks[t].func);
+            }
+            catch(...) {
+                e = current_exception();
+            }
+            lock.lock();
+
+            if(e && !error) error = e;
+            done++;
+            for(size_t k = 0; k < dependents[t].size(); ++k) {
+                int d = dependents[t][k];
+                if(--waiting[d] == 0) ready.push_back(d);
+            }
+            wake.notify_all();
+        }
+
+        insideTask = false;
+    };
+
+    vector<thread> threads;
+    for(int i = 1; i < workers; ++i) threads.push_back(thread(worker));
+    worker();
+
+    for(size_t i = 0; i < threads.size(); ++i) threads[i].join();
+
+    if(error) rethrow_exception(error);
+}
+
+void TaskGraph::start() {
+    assert(!runner.joinable() && "graph is already running");
+
+    error = exception_ptr();
+    runner = thread([this]() {
+        try {
+            run();
+        }
+        catch(...) {
+            error = current_exception();
+        }
+    });
+}
+
+void TaskGraph::wait() {
+    if(runner.joinable()) runner.join();
+    tasks.clear();
+
+    if(error) {
+        exception_ptr e = error;
+        error = exception_ptr();
+        rethrow_exception(e);
+    }
+}
+
+TaskGraph::~TaskGraph() {
+    if(runner.joinable()) runner.join();
+}
+
+RowProgress::RowProgress() {
+    rows = stripRows = ready = 0;
+    failed = false;
+}
+
+void RowProgress::reset(int rows, int stripRows) {
+    assert(rows > 0 && stripRows > 0);
+    lock_guard<mutex> lock(m);
+
+    this->rows = rows;
+    this->stripRows = stripRows;
+    ready = 0;
+    failed = false;
+    done.assign((rows + stripRows - 1) / stripRows, 0);
+}
+
+void RowProgress::finish(int y0) {
+    {
+        lock_guard<mutex> lock(m);
+
+        done[y0 / stripRows] = 1;
+        size_t s = ready / stripRows;
+        while(s < done.size() && done[s]) s++;
+        ready = min((int) s * stripRows, rows);
+    }
+    changed.notify_all();
+}
+
+void RowProgress::abort() {
+    {
+        lock_guard<mutex> lock(m);
+        failed = true;
+    }
+    changed.notify_all();
+}
+
+bool RowProgress::wait(int rows) {
+    unique_lock<mutex> lock(m);
+
+    // default constructed: no producer
+    if(done.empty()) return !failed;
+
+    changed.wait(lock, [&]() { return ready >= min(rows, this->rows) || failed; });
+    return ready >= min(rows, this->rows);
+}
@@ -0,0 +1,79 @@
+#ifndef TASKGRAPH_H
+#define TASKGRAPH_H
+
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+/* Small dependency graph for the preprocessing (image loading, transforms, cost function setup).
+ * add() returns the task id, dependencies have to be added before the task. run() executes every
+ * task once on getNumThreads() worker threads, a task starts as soon as its dependencies are done.
+ * Each task is traced under its name (string literal). An exception of a task is rethrown by run()
+ * after the running tasks finished, tasks that were not started yet are skipped.
+ * run() called from inside a task executes the nested graph on the calling thread, in order.
+ * start() runs the graph in the background instead, wait() joins it, rethrows its exception and
+ * leaves the graph empty for reuse.
+ */
+class TaskGraph
+{
+public:
+    typedef std::function<void()> Func;
+
+    int add(const char* name, Func func, const std::vector<int> &deps = std::vector<int>());
+    int add(const char* name, Func func, int dep);
+
+    void run();
+
+    void start();
+    void wait();
+
+    size_t size() const { return tasks.size(); }
+
+    ~TaskGraph();
+
+private:
+    struct Task {
+        const char* name;
+        Func func;
+        std::vector<int> deps;
+    };
+
+    std::vector<Task> tasks;
+
+    std::thread runner;         // start()
+    std::exception_ptr error;
+};
+
+/* Rows of an image that a background producer prepares in strips (see CostFunction::rowsReady).
+ * Strips may finish in any order, rows [0, ready) are published once all strips above are done.
+ * Default constructed everything is ready. abort() wakes the waiters of a failed producer.
+ */
+class RowProgress
+{
+public:
+    RowProgress();
+
+    void reset(int rows, int stripRows);    // nothing ready
+    void finish(int y0);                    // strip starting at row y0 is done
+    void abort();
+    bool wait(int rows);                    // until rows [0, rows) are ready, false if aborted
+
+private:
+    std::mutex m;
+    std::condition_variable changed;
+
+    int rows;
+    int stripRows;
+    int ready;
+    bool failed;
+    std::vector<char> done;                 // per strip
+
+    RowProgress(const RowProgress &);
+    RowProgress &operator=(const RowProgress &);
+};
+
+#endif // TASKGRAPH_H
@@ -0,0 +1,426 @@
+/*
+ * Accuracy vs. speed evaluation of BlockMatching::compute on stereo pairs with known disparity.
+ *
+ * Usage: mybm_eval [--scene randomdot|plane|all] [--size <width> <height>]
+ *                  [--pair <left> <right> <groundtruth.pfm>]
+ *                  [--blocksizes 3,5,7] [--functions "rgb;rgb,gradient;census"] [--occ 1,1.5]
+ *                  [--threshold <bad pixel threshold>] [--opencv] [--csv <file>]
+ *
+ * Synthetic scenes are generated with a fixed seed: "randomdot" is a random dot background with a
+ * square in front of it (occluded background pixels are excluded), "plane" a slanted textured plane.
+ * Middlebury style PFM ground truth can be given with --pair (inf = unknown).
+ * Every scene is matched with every configuration (blocksize x functions x occlusion penalty),
+ * reported are bad pixel rate, RMS error, wall time and peak memory (VmHWM) per run. All runs of a
+ * scene are scored on the same pixels: valid ground truth outside the widest unmatched border of
+ * all configurations.
+ */
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdio>
+#include <cstring>
+
+#include "blockmatching.h"
+#include "costfactory.h"
+
+using namespace std;
+using namespace cv;
+
+static const uint64 SEED = 0x6d79626d;
+
+struct Scene {
+    string name;
+    Mat left, right;
+    Mat groundTruth;        // CV_32F, left view
+    Mat valid;              // CV_8U, 0 where the ground truth is unknown or occluded
+};
+
+struct EvalConfig {
+    string name;            // empty: BlockMatching
+    string functions;
+    int blocksize;
+    float occlusion;
+};
+
+struct EvalResult {
+    string scene;
+    string config;
+    double badPixels;       // fraction of valid pixels with |d - gt| > threshold
+    double rms;
+    double seconds;
+    double peakMB;
+};
+
+// textured noise image, smooth blobs of several scales
+static Mat texture(Size size, RNG &rng) {
+    Mat tex = Mat::zeros(size, CV_32FC3);
+
+    for(int scale = 1; scale <= 8; scale *= 2) {
+        Mat small(size.height / scale + 2, size.width / scale + 2, CV_32FC3);
+        rng.fill(small, RNG::UNIFORM, Scalar::all(0), Scalar::all(255.0 / 4));
+
+        Mat up;
+        resize(small, up, Size(size.width + 2 * scale, size.height + 2 * scale), 0, 0, INTER_LINEAR);
+        tex += up(Rect(0, 0, size.width, size.height));
+    }
+
+    Mat out;
+    tex.convertTo(out, CV_8UC3);
+    return out;
+}
+
+/*
+ * Random dots, background with disparity d0, square with d1 in front of it.
+ * left(x) = layer(x), right(x) = layer(x + d) -> right(x - d) shows left(x)
+ */
+static Scene randomDotScene(Size size, int d0, int d1) {
+    Scene s;
+    s.name = format("randomdot_%dx%d", size.width, size.height);
+
+    RNG rng(SEED);
+    Mat back(size.height, size.width + d1, CV_8UC3);
+    Mat front(size.height, size.width + d1, CV_8UC3);
+    rng.fill(back, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+    rng.fill(front, RNG::UNIFORM, Scalar::all(0), Scalar::all(256));
+
+    Rect square(size.width / 3, size.height / 4, size.width / 3, size.height / 2);
+
+    s.left.create(size, CV_8UC3);
+    s.right.create(size, CV_8UC3);
+    s.groundTruth.create(size, CV_32F);
+    s.valid = Mat::zeros(size, CV_8U);
+
+    for(int y = 0; y < size.height; ++y) {
+        for(int x = 0; x < size.width; ++x) {
+            bool inFront = square.contains(Point(x, y));
+            s.left.at<Vec3b>(y, x) = inFront ? front.at<Vec3b>(y, x) : back.at<Vec3b>(y, x);
+            s.groundTruth.at<float>(y, x) = inFront ? d1 : d0;
+
+            // right pixel x shows the front square if x + d1 lies in it (left coordinates)
+            bool rightFront = square.contains(Point(x + d1, y));
+            s.right.at<Vec3b>(y, x) = rightFront ? front.at<Vec3b>(y, x + d1) : back.at<Vec3b>(y, x + d0);
+
+            // background pixels hidden behind the square in the right view have no match
+            int xr = x - d0;
+            bool occluded = !inFront && square.contains(Point(xr + d1, y));
+            if(xr >= 0 && !occluded) s.valid.at<uchar>(y, x) = 255;
+            if(inFront && x - d1 >= 0) s.valid.at<uchar>(y, x) = 255;
+        }
+    }
+
+    return s;
+}
+
+/*
+ * Slanted textured plane d(x, y) = a + b * x + c * y.
+ * Right pixel xr shows left pixel x with x - d(x, y) = xr -> x = (xr + a + c * y) / (1 - b)
+ */
+static Scene planeScene(Size size, float a, float b, float c) {
+    Scene s;
+    s.name = format("plane_%dx%d", size.width, size.height);
+
+    RNG rng(SEED + 1);
+    s.left = texture(size, rng);
+
+    Mat mapX(size, CV_32F), mapY(size, CV_32F);
+    s.groundTruth.create(size, CV_32F);
+    s.valid = Mat::zeros(size, CV_8U);
+
+    for(int y = 0; y < size.height; ++y) {
+        for(int x = 0; x < size.width; ++x) {
+            mapX.at<float>(y, x) = (x + a + c * y) / (1 - b);
+            mapY.at<float>(y, x) = y;
+
+            float d = a + b * x + c * y;
+            s.groundTruth.at<float>(y, x) = d;
+            if(x - d >= 0) s.valid.at<uchar>(y, x) = 255;
+        }
+    }
+
+    remap(s.left, s.right, mapX, mapY, INTER_LINEAR, BORDER_REPLICATE);
+
+    return s;
+}
+
+// Middlebury PFM: "Pf" header, width height, scale (< 0 little endian), rows bottom to top
+static bool readPFM(const string &path, Mat &image) {
+    ifstream in(path.c_str(), ios::binary);
+    if(!in) return false;
+
+    string magic;
+    int width, height;
+    float scale;
+    in >> magic >> width >> height >> scale;
+    in.get();
+
+    if(magic != "Pf" || width <= 0 || height <= 0) return false;
+
+    image.create(height, width, CV_32F);
+    for(int y = height - 1; y >= 0; --y)
+        in.read((char*) image.ptr<float>(y), width * sizeof(float));
+
+    if(scale > 0) {     // big endian
+        for(int y = 0; y < height; ++y) {
+            uchar* p = image.ptr<uchar>(y);
+            for(int x = 0; x < width; ++x, p += 4) {
+                swap(p[0], p[3]);
+                swap(p[1], p[2]);
+            }
+        }
+    }
+
+    return (bool) in;
+}
+
+static bool loadScene(const string &left, const string &right, const string &gt, Scene &s) {
+    s.name = left;
+    s.left = imread(left);
+    s.right = imread(right);
+    if(s.left.empty() || s.right.empty() || !readPFM(gt, s.groundTruth)) {
+        cout << "could not load " << left << " / " << right << " / " << gt << endl;
+        return false;
+    }
+
+    s.valid = Mat::zeros(s.groundTruth.size(), CV_8U);
+    for(int y = 0; y < s.groundTruth.rows; ++y) {
+        for(int x = 0; x < s.groundTruth.cols; ++x) {
+            float d = s.groundTruth.at<float>(y, x);
+            if(d == d && d < numeric_limits<float>::max()) s.valid.at<uchar>(y, x) = 255;
+        }
+    }
+
+    return true;
+}
+
+// peak resident memory of the process (VmHWM), reset before each run
+static void resetPeakMemory() {
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if(f) {
+        fputs("5", f);
+        fclose(f);
+    }
+}
+
+static double peakMemoryMB() {
+    ifstream in("/proc/self/status");
+    string line;
+
+    while(getline(in, line)) {
+        if(line.compare(0, 6, "VmHWM:") == 0)
+            return atof(line.c_str() + 6) / 1024.0;
+    }
+
+    return 0;
+}
+
+// disparities of StereoBM/StereoSGBM, ground truth maximum rounded up to 16 plus 16
+static int numDisparities(const Scene &s) {
+    double maxGT;
+    minMaxLoc(s.groundTruth, 0, &maxGT, 0, 0, s.valid);
+    return ((int) maxGT / 16 + 2) * 16;
+}
+
+// columns/rows at the image border a configuration leaves unmatched
+static int unmatchedBorder(const Scene &s, const EvalConfig &c) {
+    if(c.name == "StereoBM" || c.name == "StereoSGBM") return numDisparities(s);
+    return c.blocksize / 2;
+}
+
+// valid ground truth pixels outside the border
+static int scoredPixels(const Scene &s, int border) {
+    if(2 * border >= s.valid.cols || 2 * border >= s.valid.rows) return 0;
+    return countNonZero(s.valid(Rect(border, border, s.valid.cols - 2 * border, s.valid.rows - 2 * border)));
+}
+
+// errors over valid pixels outside the unmatched border
+static void score(const Scene &s, Mat disparity, int border, float threshold, EvalResult &r) {
+    double bad = 0, sq = 0, count = 0;
+
+    for(int y = border; y < disparity.rows - border; ++y) {
+        for(int x = border; x < disparity.cols - border; ++x) {
+            if(!s.valid.at<uchar>(y, x)) continue;
+
+            double err = disparity.at<float>(y, x) - s.groundTruth.at<float>(y, x);
+            if(fabs(err) > threshold) bad++;
+            sq += err * err;
+            count++;
+        }
+    }
+
+    r.badPixels = count > 0 ? bad / count : 0;
+    r.rms = count > 0 ? sqrt(sq / count) : 0;
+}
+
+// border: common to all configurations of the scene, so the errors are comparable
+static EvalResult runConfig(const Scene &s, const EvalConfig &c, int border, float threshold) {
+    EvalResult r;
+    r.scene = s.name;
+
+    Mat disparity;
+
+    resetPeakMemory();
+    int64 start = getTickCount();
+
+    if(c.name == "StereoBM" || c.name == "StereoSGBM") {
+        r.config = format("%s b%d", c.name.c_str(), c.blocksize);
+
+        int disparities = numDisparities(s);
+
+        Mat fixedPoint;
+        if(c.name == "StereoBM") {
+            Mat lg, rg;
+            cvtColor(s.left, lg, COLOR_BGR2GRAY);
+            cvtColor(s.right, rg, COLOR_BGR2GRAY);
+            StereoBM::create(disparities, max(c.blocksize, 5))->compute(lg, rg, fixedPoint);
+        }
+        else {
+            int b = c.blocksize;
+            StereoSGBM::create(0, disparities, b, 8 * 3 * b * b, 32 * 3 * b * b)->compute(s.left, s.right, fixedPoint);
+        }
+
+        // 4 fractional bits, invalid < 0
+        fixedPoint.convertTo(disparity, CV_32F, 1.0 / 16);
+        disparity.setTo(Scalar(0), disparity < 0);
+    }
+    else {
+        r.config = format("%s b%d occ%g", c.functions.c_str(), c.blocksize, c.occlusion);
+
+        BlockMatching bm;
+        bm.occlusionSouth = c.occlusion;
+        bm.occlusionEast = c.occlusion;
+        if(!addCostFunctions(bm, c.functions, s.left, s.right)) {
+            r.badPixels = r.rms = r.seconds = r.peakMB = -1;
+            return r;
+        }
+
+        bm.compute(s.left.size(), c.blocksize).convertTo(disparity, CV_32F);
+    }
+
+    r.seconds = (getTickCount() - start) / getTickFrequency();
+    r.peakMB = peakMemoryMB();
+
+    score(s, disparity, border, threshold, r);
+
+    return r;
+}
+
+static vector<string> split(const string &list, char sep) {
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+
+    while(getline(ss, item, sep)) {
+        if(!item.empty()) items.push_back(item);
+    }
+
+    return items;
+}
+
+int main(int argc, char *argv[])
+{
+    string sceneName = "all";
+    Size size(160, 120);
+    string pairLeft, pairRight, pairGT;
+    vector<string> blocksizes = split("3,5", ',');
+    vector<string> functions = split("rgb;gradient;census", ';');
+    vector<string> occlusions = split("1", ',');
+    float threshold = 1.0f;
+    bool opencv = false;
+    string csvFile;
+
+    for(int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+
+        if(arg == "--scene" && i + 1 < argc) sceneName = argv[++i];
+        if(arg == "--size" && i + 2 < argc) {
+            size.width = atoi(argv[++i]);
+            size.height = atoi(argv[++i]);
+        }
+        if(arg == "--pair" && i + 3 < argc) {
+            pairLeft = argv[++i];
+            pairRight = argv[++i];
+            pairGT = argv[++i];
+        }
+        if(arg == "--blocksizes" && i + 1 < argc) blocksizes = split(argv[++i], ',');
+        if(arg == "--functions" && i + 1 < argc) functions = split(argv[++i], ';');
+        if(arg == "--occ" && i + 1 < argc) occlusions = split(argv[++i], ',');
+        if(arg == "--threshold" && i + 1 < argc) threshold = atof(argv[++i]);
+        if(arg == "--opencv") opencv = true;
+        if(arg == "--csv" && i + 1 < argc) csvFile = argv[++i];
+        if(arg == "-h" || arg == "--help") {
+            cout << "Usage: mybm_eval [--scene randomdot|plane|all] [--size <w> <h>] [--pair <left> <right> <gt.pfm>]" << endl;
+            cout << "\t[--blocksizes 3,5] [--functions \"rgb;gradient;census\"] [--occ 1,1.5] [--threshold 1] [--opencv] [--csv <file>]" << endl;
+            return 0;
+        }
+    }
+
+    vector<Scene> scenes;
+    if(sceneName == "randomdot" || sceneName == "all") scenes.push_back(randomDotScene(size, 4, 12));
+    if(sceneName == "plane" || sceneName == "all") scenes.push_back(planeScene(size, 4.0f, 0.05f, 0.02f));
+    if(!pairLeft.empty()) {
+        Scene s;
+        if(!loadScene(pairLeft, pairRight, pairGT, s)) return 1;
+        scenes.push_back(s);
+    }
+
+    vector<EvalConfig> configs;
+    for(size_t b = 0; b < blocksizes.size(); ++b) {
+        for(size_t f = 0; f < functions.size(); ++f) {
+            for(size_t o = 0; o < occlusions.size(); ++o) {
+                EvalConfig c;
+                c.functions = functions[f];
+                c.blocksize = atoi(blocksizes[b].c_str());
+                c.occlusion = atof(occlusions[o].c_str());
+                configs.push_back(c);
+            }
+        }
+
+        if(opencv) {
+            EvalConfig c;
+            c.blocksize = atoi(blocksizes[b].c_str());
+            c.occlusion = 0;
+            c.name = "StereoBM";
+            configs.push_back(c);
+            c.name = "StereoSGBM";
+            configs.push_back(c);
+        }
+    }
+
+    vector<EvalResult> results;
+    cout << left << setw(22) << "scene" << setw(34) << "config" << right
+         << setw(10) << "bad%" << setw(10) << "rms" << setw(12) << "seconds" << setw(10) << "peakMB" << endl;
+
+    for(size_t s = 0; s < scenes.size(); ++s) {
+        int border = 0;
+        for(size_t c = 0; c < configs.size(); ++c)
+            border = max(border, unmatchedBorder(scenes[s], configs[c]));
+
+        cout << scenes[s].name << ": scored on " << scoredPixels(scenes[s], border) << " pixels (border " << border << ")" << endl;
+
+        for(size_t c = 0; c < configs.size(); ++c) {
+            EvalResult r = runConfig(scenes[s], configs[c], border, threshold);
+            results.push_back(r);
+
+            cout << left << setw(22) << r.scene << setw(34) << r.config << right << fixed << setprecision(2)
+                 << setw(10) << r.badPixels * 100 << setw(10) << r.rms
+                 << setw(12) << setprecision(3) << r.seconds << setw(10) << setprecision(1) << r.peakMB << endl;
+        }
+    }
+
+    if(!csvFile.empty()) {
+        ofstream out(csvFile.c_str());
+        out << "scene,config,bad_pixels,rms,seconds,peak_mb\n";
+        for(size_t i = 0; i < results.size(); ++i) {
+            const EvalResult &r = results[i];
+            out << r.scene << "," << r.config << "," << r.badPixels << "," << r.rms << ","
+                << r.seconds << "," << r.peakMB << "\n";
+        }
+    }
+
+    return 0;
+}
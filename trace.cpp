@@ -0,0 +1,156 @@
+#include "trace.h"
+
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+
+using namespace std;
+using namespace cv;
+
+struct TraceEvent {
+    const char* name;
+    int64 start;
+    int64 end;
+};
+
+// one buffer per thread, recording does not need a lock
+struct TraceBuffer {
+    int tid;
+    vector<TraceEvent> events;
+};
+
+bool Trace::enabled = false;
+thread_local const char* Trace::stage = 0;
+
+static mutex buffersMutex;
+static vector<TraceBuffer*> buffers;
+static int64 origin = getTickCount();
+
+static TraceBuffer* localBuffer() {
+    static thread_local TraceBuffer* local = 0;
+
+    if(!local) {
+        lock_guard<mutex> lock(buffersMutex);
+        local = new TraceBuffer();
+        local->tid = (int) buffers.size();
+        local->events.reserve(1024);
+        buffers.push_back(local);
+    }
+
+    return local;
+}
+
+void Trace::record(const char* name, int64 start, int64 end) {
+    TraceEvent e;
+    e.name = name;
+    e.start = start;
+    e.end = end;
+
+    localBuffer()->events.push_back(e);
+}
+
+void Trace::clear() {
+    lock_guard<mutex> lock(buffersMutex);
+
+    for(size_t i = 0; i < buffers.size(); ++i)
+        buffers[i]->events.clear();
+
+    origin = getTickCount();
+}
+
+static double toMicroseconds(int64 ticks) {
+    return ticks * 1e6 / getTickFrequency();
+}
+
+bool Trace::writeChrome(const string &path) {
+    lock_guard<mutex> lock(buffersMutex);
+
+    ofstream out(path.c_str());
+    if(!out) {
+        cout << "could not create " << path << endl;
+        return false;
+    }
+
+    out << fixed << setprecision(3);
+    out << "{\"traceEvents\":[\n";
+
+    bool first = true;
+    for(size_t b = 0; b < buffers.size(); ++b) {
+        const TraceBuffer* buf = buffers[b];
+
+        for(size_t i = 0; i < buf->events.size(); ++i) {
+            const TraceEvent &e = buf->events[i];
+
+            out << (first ? "" : ",\n")
+                << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << buf->tid
+                << ",\"ts\":" << toMicroseconds(e.start - origin)
+                << ",\"dur\":" << toMicroseconds(e.end - e.start) << "}";
+            first = false;
+        }
+    }
+
+    out << "\n]}\n";
+
+    return true;
+}
+
+struct TraceStats {
+    long calls;
+    double total;               // microseconds
+    double max;
+    map<int, double> perThread;
+};
+
+// per stage statistics over all threads
+static void collect(map<string, TraceStats> &stats) {
+    lock_guard<mutex> lock(buffersMutex);
+
+    for(size_t b = 0; b < buffers.size(); ++b) {
+        const TraceBuffer* buf = buffers[b];
+
+        for(size_t i = 0; i < buf->events.size(); ++i) {
+            const TraceEvent &e = buf->events[i];
+            double us = toMicroseconds(e.end - e.start);
+
+            TraceStats &s = stats[e.name];
+            s.calls++;
+            s.total += us;
+            s.max = std::max(s.max, us);
+            s.perThread[buf->tid] += us;
+        }
+    }
+}
+
+void Trace::totals(map<string, double> &ms) {
+    map<string, TraceStats> stats;
+    collect(stats);
+
+    ms.clear();
+    for(map<string, TraceStats>::iterator it = stats.begin(); it != stats.end(); ++it)
+        ms[it->first] = it->second.total / 1000;
+}
+
+void Trace::printSummary(ostream &out) {
+    map<string, TraceStats> stats;
+    collect(stats);
+
+    // slowest thread per stage shows stragglers
+    out << left << setw(28) << "stage" << right << setw(10) << "calls" << setw(14) << "total ms"
+        << setw(12) << "mean us" << setw(12) << "max us" << setw(9) << "threads" << setw(16) << "slowest thr ms" << endl;
+
+    for(map<string, TraceStats>::iterator it = stats.begin(); it != stats.end(); ++it) {
+        const TraceStats &s = it->second;
+
+        double slowest = 0;
+        for(map<int, double>::const_iterator t = s.perThread.begin(); t != s.perThread.end(); ++t)
+            slowest = std::max(slowest, t->second);
+
+        out << left << setw(28) << it->first << right << fixed << setprecision(3)
+            << setw(10) << s.calls << setw(14) << s.total / 1000 << setw(12) << s.total / s.calls
+            << setw(12) << s.max << setw(9) << s.perThread.size() << setw(16) << slowest / 1000 << endl;
+    }
+
+    out.unsetf(ios::fixed);
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <map>
+#include <ostream>
+
+/* Lightweight hot path tracing.
+ * TRACE_SCOPE("name") times the enclosing scope (wall time) and records it per thread while
+ * Trace::enabled is set. MYBM_NO_TRACE (cmake -DMYBM_TRACE=OFF) compiles the timing out, the
+ * scopes then only keep the current stage (StageScope).
+ * Names have to be string literals, they are stored as pointers.
+ * The innermost scope of a thread is its current stage (memory accounting, see memstats.h).
+ */
+class Trace
+{
+public:
+    static bool enabled;
+    static thread_local const char* stage;
+
+    static void record(const char* name, int64 start, int64 end);
+    static void clear();
+
+    static bool writeChrome(const std::string &path);      // chrome://tracing / perfetto JSON
+    static void printSummary(std::ostream &out);
+    static void totals(std::map<std::string, double> &ms);      // total wall time per stage
+};
+
+class TraceScope
+{
+public:
+    TraceScope(const char* name) : name(name), parent(Trace::stage), start(Trace::enabled ? cv::getTickCount() : 0) {
+        Trace::stage = name;
+    }
+    ~TraceScope() {
+        if(start) Trace::record(name, start, cv::getTickCount());
+        Trace::stage = parent;
+    }
+
+private:
+    const char* name;
+    const char* parent;
+    int64 start;
+};
+
+// current stage only, no timing
+class StageScope
+{
+public:
+    StageScope(const char* name) : parent(Trace::stage) {
+        Trace::stage = name;
+    }
+    ~StageScope() {
+        Trace::stage = parent;
+    }
+
+private:
+    const char* parent;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+#ifdef MYBM_NO_TRACE
+#define TRACE_SCOPE(name) StageScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#endif
+
+#endif // TRACE_H